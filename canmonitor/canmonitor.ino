@@ -0,0 +1,230 @@
+#include <can.h>
+#include <Streaming.h>
+
+/* CAN bus monitor
+ * Listens to the bus without acknowledging or sending anything and reports once per second:
+ * the bus load, frames per second and the arrival interval (min / max, jitter) of every identifier,
+ * error frames and frames lost by the monitor itself.
+ * Send 'C' over the serial connection to switch to a binary capture of every frame, 'S' to switch back.
+ */
+
+using CAN = CANBus<32, 2, 4>; // receive only
+
+constexpr uint32_t serialBaudRate = 1000000;
+constexpr uint32_t canBitRate = CAN::BitRate100k; // used if no traffic is heard on startup
+constexpr uint16_t canDetectTimeout = 500; // ms per bit rate
+constexpr uint32_t reportInterval = 1000; // ms
+
+// binary capture, all values little endian
+constexpr uint8_t captureFrameSync = 0xA5; // flags (bit 7: extended, bit 6: RTR, bit 0 - 3: length), us, identifier (2 or 4 bytes), data
+constexpr uint8_t captureReportSync = 0x5A; // us, bus load (0.01 %), frames, error frames, lost frames (2 bytes each)
+
+constexpr uint8_t identifierCount = 24;
+
+using IdentifierStats = struct
+{
+  CAN::ExtIdentifier identifier; // including the extended and RTR flags
+  uint16_t frames; // in the current interval
+  uint32_t lastArrival; // us
+  uint32_t minInterval; // us, in the current interval
+  uint32_t maxInterval;
+};
+
+IdentifierStats identifierStats[identifierCount];
+uint8_t identifiersUsed = 0;
+uint16_t otherFrames = 0; // identifiers that did not fit into identifierStats
+
+uint32_t bitRate;
+uint32_t busBits = 0; // nominal length of all frames in the current interval, without stuff bits
+uint16_t frames = 0;
+uint16_t captureDrops = 0; // serial connection too slow
+uint32_t reportStart = 0;
+CAN::Stats lastStats;
+
+bool capture = false;
+
+// SOF, identifier, RTR, IDE, r0, DLC, data, CRC, ACK, EOF, IFS (plus SRR, IDE, r1 and 18 bits for extended frames)
+uint8_t frameBits(const CAN::MessageEvent * message)
+{
+  return (message->hasExtIdentifier()? 67 : 47) + (message->isRTR()? 0 : 8 * message->length());
+}
+
+void countFrame(const CAN::MessageEvent * message, uint32_t arrival)
+{
+  ++frames;
+  busBits += frameBits(message);
+
+  uint8_t i = 0;
+  while(i < identifiersUsed && identifierStats[i].identifier != message->identifier)
+  {
+    ++i;
+  }
+  if(i == identifiersUsed)
+  {
+    if(identifiersUsed == identifierCount)
+    {
+      ++otherFrames;
+      return;
+    }
+    identifierStats[i].identifier = message->identifier;
+    identifierStats[i].frames = 0;
+    identifierStats[i].lastArrival = arrival;
+    identifierStats[i].minInterval = UINT32_MAX;
+    identifierStats[i].maxInterval = 0;
+    ++identifiersUsed;
+  }
+  else
+  {
+    uint32_t interval = arrival - identifierStats[i].lastArrival;
+    identifierStats[i].lastArrival = arrival;
+    if(interval < identifierStats[i].minInterval)
+    {
+      identifierStats[i].minInterval = interval;
+    }
+    if(interval > identifierStats[i].maxInterval)
+    {
+      identifierStats[i].maxInterval = interval;
+    }
+  }
+  ++identifierStats[i].frames;
+}
+
+void writeLittleEndian(uint32_t value, uint8_t length)
+{
+  for(uint8_t i = 0; i < length; ++i)
+  {
+    Serial.write((uint8_t)(value & 0xFF));
+    value >>= 8;
+  }
+}
+
+void captureFrame(const CAN::MessageEvent * message, uint32_t arrival)
+{
+  uint8_t length = message->isRTR()? 0 : message->length();
+  uint8_t identifierLength = message->hasExtIdentifier()? 4 : 2;
+  if(Serial.availableForWrite() < 6 + identifierLength + length)
+  {
+    ++captureDrops; // never block, the receive queue would overflow
+    return;
+  }
+
+  Serial.write(captureFrameSync);
+  Serial.write((uint8_t)((message->hasExtIdentifier()? 0x80 : 0x00) | (message->isRTR()? 0x40 : 0x00) | message->length()));
+  writeLittleEndian(arrival, 4);
+  writeLittleEndian(message->extIdentifier(), identifierLength);
+  Serial.write(message->content, length);
+}
+
+void report(uint32_t elapsed)
+{
+  CAN::Stats stats;
+  CAN::getStats(&stats);
+  uint16_t errorFrames = stats.messageErrors - lastStats.messageErrors;
+  uint16_t lostFrames = (stats.receiveDrops - lastStats.receiveDrops) +
+                        (stats.receiveOverruns[0] - lastStats.receiveOverruns[0]) +
+                        (stats.receiveOverruns[1] - lastStats.receiveOverruns[1]);
+  lastStats = stats;
+
+  uint16_t busLoad = (busBits * 100) / ((bitRate / 100) * elapsed / 1000); // 0.01 %, elapsed is at least 1000 ms
+
+  if(capture)
+  {
+    if(Serial.availableForWrite() >= 13)
+    {
+      Serial.write(captureReportSync);
+      writeLittleEndian(micros(), 4);
+      writeLittleEndian(busLoad, 2);
+      writeLittleEndian(frames, 2);
+      writeLittleEndian(errorFrames, 2);
+      writeLittleEndian(lostFrames + captureDrops, 2);
+    }
+  }
+  else
+  {
+    Serial << F("bus load ") << (busLoad / 100) << '.' << ((busLoad % 100) / 10) << (busLoad % 10) << F(" %, ")
+           << frames << F(" frames, ") << errorFrames << F(" error frames, ") << lostFrames << F(" lost, REC ")
+           << stats.receiveErrors << endl;
+    for(uint8_t i = 0; i < identifiersUsed; ++i)
+    {
+      const IdentifierStats & id = identifierStats[i];
+      if(!id.frames)
+        continue;
+      Serial << ((id.identifier & CAN::IdentifierExtended)? F("  ext 0x") : F("  0x")) << _HEX(id.identifier & CAN::IdentifierMask)
+             << ((id.identifier & CAN::IdentifierRemote)? F(" RTR: ") : F(": ")) << id.frames << F(" frames");
+      if(id.maxInterval)
+      {
+        Serial << F(", interval ") << id.minInterval << F(" - ") << id.maxInterval << F(" us (jitter ")
+               << (id.maxInterval - id.minInterval) << F(" us)");
+      }
+      Serial << endl;
+    }
+    if(otherFrames)
+    {
+      Serial << F("  other: ") << otherFrames << F(" frames") << endl;
+    }
+  }
+
+  busBits = 0;
+  frames = 0;
+  otherFrames = 0;
+  captureDrops = 0;
+  for(uint8_t i = 0; i < identifiersUsed; ++i)
+  {
+    identifierStats[i].frames = 0;
+    identifierStats[i].minInterval = UINT32_MAX;
+    identifierStats[i].maxInterval = 0;
+  }
+}
+
+void setup()
+{
+  bitRate = CAN::detectBitRate(canDetectTimeout);
+  if(!bitRate)
+  {
+    bitRate = canBitRate;
+  }
+
+  const CAN::ReceiveFilter filters[] = {
+    {false, 0, 0}, // all standard frames
+    {true, 0, 0} // all extended frames
+  };
+  CAN::start(nullptr, nullptr, bitRate, true); // listen-only before leaving configuration mode
+  CAN::setPolling(true);
+  CAN::setReceiveFilters(filters, 2);
+  CAN::getStats(&lastStats);
+
+  Serial.begin(serialBaudRate);
+  Serial << F("CAN monitor, ") << bitRate << F(" bit/s") << endl;
+  reportStart = millis();
+}
+
+void loop()
+{
+  CAN::MessageEvent message;
+  uint32_t arrival;
+  while(CAN::tryReceive(&message, &arrival))
+  {
+    countFrame(&message, arrival);
+    if(capture)
+    {
+      captureFrame(&message, arrival);
+    }
+  }
+
+  uint32_t now = millis();
+  if(now - reportStart >= reportInterval)
+  {
+    report(now - reportStart);
+    reportStart = now;
+  }
+
+  int command = Serial.read();
+  if(command == 'C')
+  {
+    capture = true;
+  }
+  else if(command == 'S')
+  {
+    capture = false;
+  }
+}
@@ -0,0 +1,123 @@
+#include "Arduino.h"
+#include "SPI.h"
+
+StatusRegister SREG;
+SPIClass SPI;
+
+StatusRegister & StatusRegister::operator=(uint8_t value)
+{
+  m_value = value;
+  if(value & 0x80)
+  {
+    Host::dispatchInterrupts();
+  }
+  return *this;
+}
+
+void cli()
+{
+  SREG = SREG & ~0x80;
+}
+
+void sei()
+{
+  SREG = SREG | 0x80;
+}
+
+uint32_t millis()
+{
+  Host::charge(Host::ClockReadTime);
+  return (uint32_t)(Host::now() / 1000);
+}
+
+uint32_t micros()
+{
+  Host::charge(Host::ClockReadTime);
+  return (uint32_t) Host::now();
+}
+
+void delay(uint32_t ms)
+{
+  Host::advance(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  Host::advance(us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  if(mode == INPUT_PULLUP)
+  {
+    Host::setInput(pin, HIGH);
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  Host::writeOutput(pin, value != LOW);
+}
+
+int digitalRead(uint8_t pin)
+{
+  return Host::readInput(pin)? HIGH : LOW;
+}
+
+void attachInterrupt(uint8_t interrupt, void (*handler)(), int mode)
+{
+  Host::attachInterrupt(interrupt, handler, mode);
+}
+
+void detachInterrupt(uint8_t interrupt)
+{
+  Host::detachInterrupt(interrupt);
+}
+
+PortRegister::operator uint8_t() const
+{
+  uint8_t value = 0;
+  for(uint8_t bit = 0; bit < m_width; ++bit)
+  {
+    value |= Host::output(m_firstPin + bit)? _BV(bit) : 0;
+  }
+  return value;
+}
+
+PortRegister & PortRegister::operator=(uint8_t value)
+{
+  for(uint8_t bit = 0; bit < m_width; ++bit)
+  {
+    Host::writeOutput(m_firstPin + bit, value & _BV(bit));
+  }
+  return *this;
+}
+
+PinRegister::operator uint8_t() const
+{
+  uint8_t value = 0;
+  for(uint8_t bit = 0; bit < m_width; ++bit)
+  {
+    value |= Host::readInput(m_firstPin + bit)? _BV(bit) : 0;
+  }
+  return value;
+}
+
+PortRegister PORTB(8, 6);
+PortRegister PORTC(14, 6);
+PortRegister PORTD(0, 8);
+PinRegister PINB(8, 6);
+PinRegister PINC(14, 6);
+PinRegister PIND(0, 8);
+volatile uint8_t DDRB;
+volatile uint8_t DDRC;
+volatile uint8_t DDRD;
+
+volatile uint8_t TCCR1A;
+volatile uint8_t TCCR1B;
+volatile uint8_t TIMSK1;
+FlagRegister TIFR1;
+volatile uint16_t TCNT1;
+volatile uint16_t ICR1;
+volatile uint16_t OCR1A;
+volatile uint16_t OCR1B;
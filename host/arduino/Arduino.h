@@ -0,0 +1,146 @@
+#pragma once
+
+// Host stand-in for the Arduino AVR core, backed by the simulation in host.h.
+// Provides what the sketches and the MaerklinCAN library use, with the same names and semantics.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+
+#define F_CPU 16000000L
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define constrain(amount, low, high) ((amount) < (low)? (low) : ((amount) > (high)? (high) : (amount)))
+
+// program memory is ordinary memory on the host
+#define PROGMEM
+#define PGM_P const char *
+#define strlen_P strlen
+
+#define digitalPinToInterrupt(p) ((p) == 2? 0 : ((p) == 3? 1 : -1))
+
+constexpr uint8_t A0 = 14;
+constexpr uint8_t A1 = 15;
+constexpr uint8_t A2 = 16;
+constexpr uint8_t A3 = 17;
+constexpr uint8_t A4 = 18;
+constexpr uint8_t A5 = 19;
+
+// AVR status register; only the I bit (0x80) has a meaning here.
+// Setting it (by assignment or sei()) runs the interrupts that became pending meanwhile.
+class StatusRegister
+{
+public:
+  operator uint8_t() const { return m_value; }
+  StatusRegister & operator=(uint8_t value);
+
+private:
+  friend class Host;
+
+  uint8_t m_value = 0x80; // init() of the Arduino core enables interrupts before setup()
+};
+extern StatusRegister SREG;
+
+void cli();
+void sei();
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+void attachInterrupt(uint8_t interrupt, void (*handler)(), int mode);
+void detachInterrupt(uint8_t interrupt);
+
+#define _BV(bit) (1 << (bit))
+
+// I/O ports, mapped to the pins D0 - D7 (port D), D8 - D13 (port B) and A0 - A5 (port C); other bits read as 0.
+// PORTx drives the outputs like digitalWrite(), PINx samples the inputs like digitalRead().
+class PortRegister
+{
+public:
+  PortRegister(uint8_t firstPin, uint8_t width) : m_firstPin(firstPin), m_width(width) {}
+
+  operator uint8_t() const;
+  PortRegister & operator=(uint8_t value);
+  PortRegister & operator|=(uint8_t value) { return *this = *this | value; }
+  PortRegister & operator&=(uint8_t value) { return *this = *this & value; }
+  PortRegister & operator^=(uint8_t value) { return *this = *this ^ value; }
+
+private:
+  uint8_t m_firstPin;
+  uint8_t m_width;
+};
+
+class PinRegister
+{
+public:
+  PinRegister(uint8_t firstPin, uint8_t width) : m_firstPin(firstPin), m_width(width) {}
+
+  operator uint8_t() const;
+
+private:
+  uint8_t m_firstPin;
+  uint8_t m_width;
+};
+
+// Interrupt flags are set by the hardware and cleared by writing a 1 (or by executing the vector).
+// A flag that is set while its interrupt is enabled makes the interrupt pending.
+class FlagRegister
+{
+public:
+  operator uint8_t() const { return m_value; }
+  FlagRegister & operator=(uint8_t value) { m_value &= ~value; return *this; }
+
+private:
+  friend class Host;
+
+  volatile uint8_t m_value = 0;
+};
+
+extern PortRegister PORTB;
+extern PortRegister PORTC;
+extern PortRegister PORTD;
+extern PinRegister PINB;
+extern PinRegister PINC;
+extern PinRegister PIND;
+extern volatile uint8_t DDRB; // direction is not simulated
+extern volatile uint8_t DDRC;
+extern volatile uint8_t DDRD;
+
+// Timer1, see Host::advanceTimer1() for what is simulated
+extern volatile uint8_t TCCR1A;
+extern volatile uint8_t TCCR1B;
+extern volatile uint8_t TIMSK1;
+extern FlagRegister TIFR1;
+extern volatile uint16_t TCNT1;
+extern volatile uint16_t ICR1;
+extern volatile uint16_t OCR1A;
+extern volatile uint16_t OCR1B;
+
+#define TOIE1 0
+#define TOV1 0
+
+// only TIMER1_OVF_vect is dispatched
+#define ISR(vector) extern "C" void vector()
+
+#include "HardwareSerial.h"
@@ -0,0 +1,12 @@
+#include "EEPROM.h"
+#include "host.h"
+
+EEPROMClass EEPROM;
+
+void EEPROMClass::write(int address, uint8_t value)
+{
+  if(address < 0 || address >= Size)
+    return;
+  m_content[address] = value;
+  Host::advance(3300);
+}
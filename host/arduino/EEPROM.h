@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// EEPROM of the ATmega328P, erased (0xFF) at startup and not kept between runs.
+// A write takes 3.3 ms of virtual time.
+class EEPROMClass
+{
+public:
+  static constexpr uint16_t Size = 1024;
+
+  EEPROMClass() { memset(m_content, 0xFF, Size); }
+
+  uint8_t read(int address) { return (address >= 0 && address < Size)? m_content[address] : 0xFF; }
+  void write(int address, uint8_t value);
+  void update(int address, uint8_t value)
+  {
+    if(read(address) != value)
+      write(address, value);
+  }
+  uint16_t length() { return Size; }
+
+  template<typename T> T & get(int address, T & value)
+  {
+    uint8_t * bytes = reinterpret_cast<uint8_t *>(&value);
+    for(uint16_t i = 0; i < sizeof(T); ++i)
+    {
+      bytes[i] = read(address + i);
+    }
+    return value;
+  }
+
+  template<typename T> const T & put(int address, const T & value)
+  {
+    const uint8_t * bytes = reinterpret_cast<const uint8_t *>(&value);
+    for(uint16_t i = 0; i < sizeof(T); ++i)
+    {
+      update(address + i, bytes[i]);
+    }
+    return value;
+  }
+
+private:
+  uint8_t m_content[Size];
+};
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,87 @@
+#include "HardwareSerial.h"
+#include "host.h"
+
+#include <poll.h>
+#include <stdio.h>
+#include <unistd.h>
+
+HardwareSerial Serial;
+
+void HardwareSerial::begin(unsigned long baudRate)
+{
+  m_byteTime = baudRate? (10000000 + baudRate - 1) / baudRate : 0;
+  m_sendEnd = Host::now();
+}
+
+int HardwareSerial::availableForWrite()
+{
+  return TxBufferSize - 1 - queued();
+}
+
+int HardwareSerial::available()
+{
+  return (peek() >= 0)? 1 : 0;
+}
+
+int HardwareSerial::peek()
+{
+  if(m_next >= 0 || m_end)
+    return m_next;
+
+  pollfd input = {STDIN_FILENO, POLLIN, 0};
+  if(poll(&input, 1, 0) <= 0)
+    return -1;
+
+  uint8_t data;
+  ssize_t count = ::read(STDIN_FILENO, &data, 1);
+  if(count == 1)
+  {
+    m_next = data;
+  }
+  else if(count == 0)
+  {
+    m_end = true;
+  }
+  return m_next;
+}
+
+int HardwareSerial::read()
+{
+  int data = peek();
+  m_next = -1;
+  return data;
+}
+
+void HardwareSerial::flush()
+{
+  fflush(stdout);
+}
+
+size_t HardwareSerial::write(uint8_t data)
+{
+  if(m_byteTime)
+  {
+    if(queued() >= TxBufferSize - 1)
+    {
+      Host::advanceTo(m_sendEnd - (TxBufferSize - 2) * m_byteTime);
+    }
+    m_sendEnd = ((m_sendEnd > Host::now())? m_sendEnd : Host::now()) + m_byteTime;
+  }
+  return (fputc(data, stdout) == EOF)? 0 : 1;
+}
+
+size_t HardwareSerial::write(const uint8_t * buffer, size_t size)
+{
+  if(m_byteTime)
+    return Print::write(buffer, size);
+  return fwrite(buffer, 1, size, stdout);
+}
+
+uint32_t HardwareSerial::queued()
+{
+  uint64_t now = Host::now();
+  if(!m_byteTime || m_sendEnd <= now)
+    return 0;
+  uint64_t bytes = (m_sendEnd - now + m_byteTime - 1) / m_byteTime;
+  return (bytes < TxBufferSize - 1)? bytes : TxBufferSize - 1;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Print.h"
+
+// Serial port connected to stdin / stdout. Input is read without blocking, as far as it is available.
+// Output is written at once, but the send buffer empties at the baud rate given to begin(): availableForWrite()
+// reports the room left, and write() waits (in virtual time) while the buffer is full, like on the AVR.
+class HardwareSerial : public Print
+{
+public:
+  static constexpr int TxBufferSize = 64; // SERIAL_TX_BUFFER_SIZE of the AVR core
+
+  void begin(unsigned long baudRate);
+  void end() { m_byteTime = 0; }
+  void setTimeout(unsigned long) {}
+
+  int available();
+  int peek();
+  int read();
+  int availableForWrite();
+  void flush();
+
+  size_t write(uint8_t data) override;
+  size_t write(const uint8_t * buffer, size_t size) override;
+  using Print::write;
+
+  explicit operator bool() { return true; }
+
+private:
+  uint32_t queued(); // bytes in the send buffer
+
+  uint32_t m_byteTime = 0; // us per byte (start, 8 data, stop bit), 0: not simulated
+  uint64_t m_sendEnd = 0; // us, when the send buffer will be empty
+  int m_next = -1; // read ahead by available() or peek()
+  bool m_end = false; // stdin is closed
+};
+
+extern HardwareSerial Serial;
@@ -0,0 +1,120 @@
+#include "Print.h"
+
+#include <string.h>
+
+size_t Print::write(const uint8_t * buffer, size_t size)
+{
+  size_t written = 0;
+  while(size--)
+  {
+    written += write(*buffer++);
+  }
+  return written;
+}
+
+size_t Print::write(const char * string)
+{
+  return write(reinterpret_cast<const uint8_t *>(string), strlen(string));
+}
+
+size_t Print::print(const __FlashStringHelper * string)
+{
+  return write(reinterpret_cast<const char *>(string));
+}
+
+size_t Print::print(const char * string)
+{
+  return write(string);
+}
+
+size_t Print::print(char c)
+{
+  return write((uint8_t) c);
+}
+
+size_t Print::print(unsigned char value, int base)
+{
+  return print((unsigned long) value, base);
+}
+
+size_t Print::print(int value, int base)
+{
+  return print((long) value, base);
+}
+
+size_t Print::print(unsigned int value, int base)
+{
+  return print((unsigned long) value, base);
+}
+
+// negative values get a sign in decimal only, like on the AVR (where long has 32 bits)
+size_t Print::print(long value, int base)
+{
+  if(base == DEC && value < 0)
+    return write('-') + printNumber((unsigned long) -value, DEC);
+  return printNumber((uint32_t) value, base);
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+  return printNumber(value, base);
+}
+
+size_t Print::print(double value, int digits)
+{
+  size_t written = 0;
+  if(value < 0.0)
+  {
+    written += write('-');
+    value = -value;
+  }
+
+  double rounding = 0.5;
+  for(int i = 0; i < digits; ++i)
+  {
+    rounding /= 10.0;
+  }
+  value += rounding;
+
+  unsigned long integer = (unsigned long) value;
+  written += printNumber(integer, DEC);
+  if(digits > 0)
+  {
+    written += write('.');
+  }
+  double remainder = value - (double) integer;
+  while(digits-- > 0)
+  {
+    remainder *= 10.0;
+    unsigned int digit = (unsigned int) remainder;
+    written += write((uint8_t)('0' + digit));
+    remainder -= digit;
+  }
+  return written;
+}
+
+size_t Print::println()
+{
+  return write("\r\n");
+}
+
+size_t Print::printNumber(unsigned long value, uint8_t base)
+{
+  if(base < 2)
+  {
+    base = 10;
+  }
+
+  char digits[8 * sizeof(value) + 1];
+  char * digit = digits + sizeof(digits);
+  *--digit = '\0';
+  do
+  {
+    uint8_t remainder = value % base;
+    value /= base;
+    *--digit = (remainder < 10)? '0' + remainder : 'A' + remainder - 10;
+  }
+  while(value);
+
+  return write(digit);
+}
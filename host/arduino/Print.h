@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+// strings in program memory are ordinary strings on the host
+class __FlashStringHelper;
+#define F(string) (reinterpret_cast<const __FlashStringHelper *>(string))
+
+// number formatting of the Arduino Print class
+class Print
+{
+public:
+  virtual size_t write(uint8_t data) = 0;
+  virtual size_t write(const uint8_t * buffer, size_t size);
+  size_t write(const char * string);
+
+  size_t print(const __FlashStringHelper * string);
+  size_t print(const char * string);
+  size_t print(char c);
+  size_t print(unsigned char value, int base = DEC);
+  size_t print(int value, int base = DEC);
+  size_t print(unsigned int value, int base = DEC);
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(double value, int digits = 2);
+
+  size_t println();
+  template<typename T> size_t println(T value)
+  {
+    return print(value) + println();
+  }
+  template<typename T> size_t println(T value, int format)
+  {
+    return print(value, format) + println();
+  }
+
+private:
+  size_t printNumber(unsigned long value, uint8_t base);
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define MSBFIRST 1
+#define SPI_MODE0 0x00
+
+// clock and mode are not simulated, every byte takes Host::SPITransferTime
+class SPISettings
+{
+public:
+  SPISettings() = default;
+  SPISettings(uint32_t, uint8_t, uint8_t) {}
+};
+
+class SPIClass
+{
+public:
+  static void begin() {}
+  static void beginTransaction(SPISettings) {}
+  static void endTransaction() {}
+
+  static uint8_t transfer(uint8_t data) // to the device whose chip select is low, 0xFF if there is none
+  {
+    return Host::transferSPI(data);
+  }
+};
+
+extern SPIClass SPI;
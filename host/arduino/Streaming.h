@@ -0,0 +1,37 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Serial << value << endl, as provided by the Streaming library
+
+template<typename T> inline Print & operator<<(Print & stream, T value)
+{
+  stream.print(value);
+  return stream;
+}
+
+struct _BASED
+{
+  long value;
+  int base;
+  _BASED(long value, int base) : value(value), base(base) {}
+};
+
+#define _HEX(value) _BASED(value, HEX)
+#define _DEC(value) _BASED(value, DEC)
+#define _OCT(value) _BASED(value, OCT)
+#define _BIN(value) _BASED(value, BIN)
+
+inline Print & operator<<(Print & stream, const _BASED & value)
+{
+  stream.print(value.value, value.base);
+  return stream;
+}
+
+enum _EndLineCode { endl };
+
+inline Print & operator<<(Print & stream, _EndLineCode)
+{
+  stream.println();
+  return stream;
+}
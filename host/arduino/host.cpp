@@ -0,0 +1,314 @@
+#include "Arduino.h"
+
+#include <chrono>
+#include <thread>
+
+ISR(TIMER1_OVF_vect) __attribute__((weak)); // defined by the sketch, if at all
+
+uint64_t Host::now()
+{
+  return s_now;
+}
+
+// the wall clock continues from the current time
+void Host::setRealTime(bool realTime)
+{
+  s_realTime = realTime;
+  s_wallClockStart = steadyClock() - s_now;
+}
+
+void Host::advance(uint32_t us)
+{
+  advanceTo(s_now + us);
+}
+
+// the time of a primitive is already spent in real time mode
+void Host::charge(uint32_t us)
+{
+  advanceTo(s_realTime? s_now : s_now + us);
+}
+
+// In steps of at most MaxStep, so interrupts are not held back by long delays.
+// In real time mode, waits for the wall clock to reach time, or catches up with it.
+void Host::advanceTo(uint64_t time)
+{
+  if(s_advancing)
+    return; // peripherals cannot move the clock
+
+  uint64_t wall = s_realTime? wallClock() : time;
+  while(wall < time)
+  {
+    std::this_thread::sleep_for(std::chrono::microseconds((time - wall > 1000)? 1000 : time - wall));
+    wall = wallClock();
+    stepTo((wall < time)? wall : time);
+  }
+
+  stepTo((wall > time)? wall : time);
+}
+
+void Host::stepTo(uint64_t time)
+{
+  while(s_now < time)
+  {
+    s_now = (time - s_now > MaxStep)? s_now + MaxStep : time;
+
+    s_advancing = true;
+    advanceTimer1();
+    for(uint8_t i = 0; i < s_peripheralCount; ++i)
+    {
+      s_peripherals[i]->advanceTo(s_now);
+    }
+    s_advancing = false;
+
+    dispatchInterrupts(); // may advance the clock further, which ends this loop early
+  }
+}
+
+void Host::attach(Host::Peripheral * peripheral)
+{
+  if(s_peripheralCount < MaxPeripherals)
+  {
+    s_peripherals[s_peripheralCount++] = peripheral;
+  }
+}
+
+void Host::connectSPI(uint8_t pinChipSelect, Host::SPIDevice * device)
+{
+  if(s_spiDeviceCount < MaxSPIDevices)
+  {
+    s_spiDevices[s_spiDeviceCount++] = {pinChipSelect, device};
+  }
+}
+
+void Host::setInput(uint8_t pin, bool level)
+{
+  if(pin >= PinCount)
+    return;
+
+  bool previous = s_inputs[pin];
+  s_inputs[pin] = level;
+
+  int interrupt = digitalPinToInterrupt(pin);
+  if(interrupt < 0 || !s_interrupts[interrupt].handler)
+    return;
+
+  bool trigger;
+  switch(s_interrupts[interrupt].mode)
+  {
+    case CHANGE:
+      trigger = level != previous;
+      break;
+    case FALLING:
+      trigger = previous && !level;
+      break;
+    case RISING:
+      trigger = !previous && level;
+      break;
+    default: // LOW
+      trigger = !level;
+      break;
+  }
+  if(trigger)
+  {
+    s_pendingInterrupts |= 0x01 << interrupt; // like INTFn, dispatched once the I bit allows it
+  }
+}
+
+bool Host::output(uint8_t pin)
+{
+  return pin < PinCount && s_outputs[pin];
+}
+
+void Host::reset()
+{
+  s_now = 0;
+  s_peripheralCount = 0;
+  s_advancing = false;
+  s_spiDeviceCount = 0;
+  s_selected = nullptr;
+  for(uint8_t pin = 0; pin < PinCount; ++pin)
+  {
+    s_outputs[pin] = false;
+    s_inputs[pin] = true;
+  }
+  for(uint8_t interrupt = 0; interrupt < InterruptCount; ++interrupt)
+  {
+    s_interrupts[interrupt] = {nullptr, LOW};
+  }
+  s_pendingInterrupts = 0;
+  SREG.m_value = 0x80;
+
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TIMSK1 = 0;
+  TIFR1.m_value = 0;
+  TCNT1 = 0;
+  ICR1 = 0;
+  OCR1A = 0;
+  OCR1B = 0;
+  s_timer1Running = false;
+
+  setRealTime(s_realTime);
+}
+
+void Host::writeOutput(uint8_t pin, bool level)
+{
+  if(pin >= PinCount)
+    return;
+
+  bool previous = s_outputs[pin];
+  s_outputs[pin] = level;
+  if(previous == level)
+    return;
+
+  for(uint8_t i = 0; i < s_spiDeviceCount; ++i)
+  {
+    if(s_spiDevices[i].pin != pin)
+      continue;
+
+    if(!level)
+    {
+      s_selected = s_spiDevices[i].device;
+      s_selected->select();
+    }
+    else if(s_selected == s_spiDevices[i].device)
+    {
+      s_selected->deselect();
+      s_selected = nullptr;
+    }
+  }
+}
+
+bool Host::readInput(uint8_t pin)
+{
+  return pin < PinCount && s_inputs[pin];
+}
+
+uint8_t Host::transferSPI(uint8_t data)
+{
+  uint8_t result = s_selected? s_selected->transfer(data) : 0xFF;
+  charge(SPITransferTime);
+  return result;
+}
+
+void Host::attachInterrupt(uint8_t interrupt, void (*handler)(), int mode)
+{
+  if(interrupt >= InterruptCount)
+    return;
+
+  s_interrupts[interrupt] = {handler, mode};
+  s_pendingInterrupts &= ~(0x01 << interrupt);
+}
+
+void Host::detachInterrupt(uint8_t interrupt)
+{
+  if(interrupt >= InterruptCount)
+    return;
+
+  s_interrupts[interrupt].handler = nullptr;
+  s_pendingInterrupts &= ~(0x01 << interrupt);
+}
+
+// lowest vector first, with the I bit cleared while a handler runs (until it calls sei() itself)
+void Host::dispatchInterrupts()
+{
+  uint8_t pending;
+  while((SREG.m_value & 0x80) && (pending = pendingInterrupts()))
+  {
+    uint8_t vector = 0;
+    while(!(pending & (0x01 << vector)))
+    {
+      ++vector;
+    }
+
+    void (*handler)() = (vector < InterruptCount)? s_interrupts[vector].handler : TIMER1_OVF_vect;
+    if(vector == VectorTimer1Overflow)
+    {
+      TIFR1.m_value &= ~(0x01 << TOV1); // cleared by executing the vector
+    }
+    else
+    {
+      s_pendingInterrupts &= ~(0x01 << vector);
+    }
+    if(!handler)
+      continue;
+
+    SREG.m_value &= ~0x80;
+    handler();
+    SREG.m_value |= 0x80; // reti
+  }
+}
+
+uint8_t Host::pendingInterrupts()
+{
+  uint8_t pending = s_pendingInterrupts;
+  if((TIFR1.m_value & (0x01 << TOV1)) && (TIMSK1 & (0x01 << TOIE1)))
+  {
+    pending |= 0x01 << VectorTimer1Overflow;
+  }
+  return pending;
+}
+
+// Overflow interrupts at the period given by the prescaler and TOP (ICR1 in modes 12 and 14, OCR1A in modes
+// 9, 11 and 15, 0xFFFF otherwise; phase correct modes are counted like fast PWM). A new TOP takes effect
+// with the next period. TCNT1 and the compare outputs are not simulated.
+void Host::advanceTimer1()
+{
+  static const uint16_t prescalers[8] = {0, 1, 8, 64, 256, 1024, 0, 0}; // 6, 7: external clock on T1
+  uint16_t prescaler = prescalers[TCCR1B & 0x07];
+  if(!prescaler)
+  {
+    s_timer1Running = false;
+    return;
+  }
+
+  uint8_t mode = ((TCCR1B >> 1) & 0x0C) | (TCCR1A & 0x03); // WGM13 - WGM10
+  uint16_t top = (mode == 12 || mode == 14)? ICR1 : ((mode == 9 || mode == 11 || mode == 15)? OCR1A : 0xFFFF);
+  uint64_t cycles = s_now * CyclesPerMicrosecond;
+  if(!s_timer1Running)
+  {
+    s_timer1Running = true;
+    s_timer1Overflow = cycles + (uint64_t)(top + 1) * prescaler;
+    return;
+  }
+
+  while(s_timer1Overflow <= cycles)
+  {
+    TIFR1.m_value |= 0x01 << TOV1;
+    s_timer1Overflow += (uint64_t)(top + 1) * prescaler;
+  }
+}
+
+uint64_t Host::wallClock()
+{
+  return steadyClock() - s_wallClockStart;
+}
+
+uint64_t Host::steadyClock()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t Host::s_now = 0;
+
+Host::Peripheral * Host::s_peripherals[Host::MaxPeripherals];
+uint8_t Host::s_peripheralCount = 0;
+bool Host::s_advancing = false;
+
+bool Host::s_realTime = false;
+uint64_t Host::s_wallClockStart = 0;
+
+Host::SPIConnection Host::s_spiDevices[Host::MaxSPIDevices];
+uint8_t Host::s_spiDeviceCount = 0;
+Host::SPIDevice * Host::s_selected = nullptr;
+
+bool Host::s_outputs[Host::PinCount];
+bool Host::s_inputs[Host::PinCount] = {true, true, true, true, true, true, true, true, true, true,
+                                        true, true, true, true, true, true, true, true, true, true};
+
+Host::ExternalInterrupt Host::s_interrupts[Host::InterruptCount];
+uint8_t Host::s_pendingInterrupts = 0;
+
+bool Host::s_timer1Running = false;
+uint64_t Host::s_timer1Overflow = 0;
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+
+// Simulation side of the host Arduino core (see Arduino.h): a virtual clock that drives the attached
+// peripherals and Timer1, the levels of input pins, interrupts and the devices behind SPI chip selects.
+// Virtual time only passes in the primitives (clock reads, SPI transfers, delays) and in advance(),
+// the CPU time of the code in between is not modelled. In real time mode the clock follows the wall clock
+// instead and the primitives only wait if they are ahead of it.
+class Host
+{
+public:
+  // simulated hardware, brought up to date whenever the virtual clock moves
+  class Peripheral
+  {
+  public:
+    virtual void advanceTo(uint64_t now) = 0; // us
+  };
+
+  // SPI slave selected by driving its chip select pin low
+  class SPIDevice
+  {
+  public:
+    virtual void select() = 0;
+    virtual uint8_t transfer(uint8_t data) = 0;
+    virtual void deselect() = 0;
+  };
+
+  static constexpr uint8_t PinCount = 20; // D0 - D13, A0 - A5
+  static constexpr uint8_t InterruptCount = 2; // INT0 (D2), INT1 (D3)
+  static constexpr uint8_t VectorTimer1Overflow = InterruptCount; // pending interrupts are numbered like the vectors
+
+  static constexpr uint32_t CyclesPerMicrosecond = 16; // F_CPU, clock of Timer1
+
+  // virtual time charged for the primitives
+  static constexpr uint32_t ClockReadTime = 1; // us per millis() / micros()
+  static constexpr uint32_t SPITransferTime = 1; // us per byte
+  static constexpr uint32_t MaxStep = 10; // us, interrupts are dispatched at least this often
+
+  static uint64_t now(); // us
+  static void setRealTime(bool realTime);
+
+  // moves the virtual clock, updates the peripherals and runs pending interrupts if the I bit is set
+  static void advance(uint32_t us);
+  static void advanceTo(uint64_t time);
+  static void charge(uint32_t us); // time taken by a primitive, ignored in real time mode
+
+  static void attach(Peripheral * peripheral);
+  static void connectSPI(uint8_t pinChipSelect, SPIDevice * device);
+
+  // drives an input pin; an edge matching the mode of an attached interrupt makes it pending
+  static void setInput(uint8_t pin, bool level);
+  static bool output(uint8_t pin); // level last written with digitalWrite()
+
+  // back to power-on: clock at 0 (virtual), pins high, Timer1 stopped, no interrupts attached,
+  // no peripherals or SPI devices
+  static void reset();
+
+  // used by the Arduino functions
+  static void writeOutput(uint8_t pin, bool level);
+  static bool readInput(uint8_t pin);
+  static uint8_t transferSPI(uint8_t data);
+  static void attachInterrupt(uint8_t interrupt, void (*handler)(), int mode);
+  static void detachInterrupt(uint8_t interrupt);
+  static void dispatchInterrupts();
+
+private:
+  Host() = default;
+
+  static void stepTo(uint64_t time);
+  static void advanceTimer1();
+  static uint8_t pendingInterrupts(); // bit n: vector n
+  static uint64_t wallClock(); // us, continues from the virtual time when real time mode was set
+  static uint64_t steadyClock(); // us
+
+  static constexpr uint8_t MaxPeripherals = 8;
+  static constexpr uint8_t MaxSPIDevices = 4;
+
+  using SPIConnection = struct
+  {
+    uint8_t pin;
+    SPIDevice * device;
+  };
+
+  using ExternalInterrupt = struct
+  {
+    void (*handler)();
+    int mode;
+  };
+
+  static uint64_t s_now;
+
+  static Peripheral * s_peripherals[MaxPeripherals];
+  static uint8_t s_peripheralCount;
+  static bool s_advancing;
+
+  static bool s_realTime;
+  static uint64_t s_wallClockStart;
+
+  static SPIConnection s_spiDevices[MaxSPIDevices];
+  static uint8_t s_spiDeviceCount;
+  static SPIDevice * s_selected;
+
+  static bool s_outputs[PinCount];
+  static bool s_inputs[PinCount];
+
+  static ExternalInterrupt s_interrupts[InterruptCount];
+  static uint8_t s_pendingInterrupts; // bit n: external interrupt n, Timer1 is pending through TIFR1 and TIMSK1
+
+  static bool s_timer1Running;
+  static uint64_t s_timer1Overflow; // cycles
+};
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+
+#include "trafficnode.h"
+
+// Runs a sketch natively on a simulated board: the MCP2515 behind CS on D10 with its INT on D2, on a bus with one
+// more node that acknowledges every frame. Serial is stdin / stdout. Time is virtual and runs as fast as the
+// host allows, or follows the wall clock with -r.
+//
+// usage: <sketch> [-r] [-t seconds] [-b bit rate]
+
+void setup();
+void loop();
+
+constexpr uint8_t PinNCS = 10;
+constexpr uint8_t PinNInt = 2;
+constexpr uint32_t LoopTime = 1; // us charged per loop() call, so a loop without clock reads cannot stall time
+
+int main(int argc, char ** argv)
+{
+  bool realTime = false;
+  uint64_t runTime = 0; // us, 0: until interrupted
+  uint32_t bitRate = 100000;
+
+  int option;
+  while((option = getopt(argc, argv, "rt:b:")) != -1)
+  {
+    switch(option)
+    {
+      case 'r':
+        realTime = true;
+        break;
+      case 't':
+        runTime = (uint64_t)(atof(optarg) * 1000000.0);
+        break;
+      case 'b':
+        bitRate = strtoul(optarg, nullptr, 0);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-r] [-t seconds] [-b bit rate]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  Host::reset();
+  Host::setRealTime(realTime);
+  VirtualBus bus(bitRate);
+  MCP2515Model controller(PinNInt);
+  Host::connectSPI(PinNCS, &controller);
+  bus.connect(&controller);
+  Host::attach(&bus);
+
+  TrafficNode layout(&bus);
+  if(!layout.start(bitRate))
+  {
+    fprintf(stderr, "%s: unsupported bit rate %lu\n", argv[0], (unsigned long) bitRate);
+    return 1;
+  }
+
+  setup();
+  while(!runTime || Host::now() < runTime)
+  {
+    loop();
+    Host::charge(LoopTime);
+  }
+  fflush(stdout);
+  return 0;
+}
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+#include <can.h>
+
+#include "trafficnode.h"
+
+// Burst load on the simulated bus: the MaerklinCAN driver runs unchanged against an MCP2515Model (CS on D10,
+// INT on D2), TrafficNodes send or receive numbered frames. Every run checks for lost and reordered frames,
+// and whether the driver accounted for each lost one (queue drops, RXB overruns). All times are virtual
+// and reproducible, except for the host time per frame.
+
+using CAN = CANBus<16, 8, 4>;
+
+constexpr uint8_t PinNCS = 10;
+constexpr uint8_t PinNInt = 2;
+constexpr uint8_t PeerCount = 3;
+constexpr uint32_t SettleTime = 20000; // us without traffic that ends a run
+
+// content: sequence number (little endian), source, pattern
+void fillFrame(VirtualBus::Frame * frame, uint16_t sequence, uint8_t source)
+{
+  frame->length = 8;
+  frame->data[0] = (uint8_t) (sequence & 0x00FF);
+  frame->data[1] = (uint8_t)((sequence & 0xFF00) >> 8);
+  frame->data[2] = source;
+  for(uint8_t i = 3; i < 8; ++i)
+  {
+    frame->data[i] = frame->data[i - 3] ^ 0xA5;
+  }
+}
+
+bool frameIntact(const uint8_t * content, uint8_t length)
+{
+  if(length != 8)
+    return false;
+  for(uint8_t i = 3; i < 8; ++i)
+  {
+    if(content[i] != (content[i - 3] ^ 0xA5))
+      return false;
+  }
+  return true;
+}
+
+// arrival order of the frames of one source
+class SequenceCheck
+{
+public:
+  void record(uint16_t sequence, uint64_t time)
+  {
+    if(!m_received)
+    {
+      m_first = time;
+    }
+    else if(sequence <= m_last)
+    {
+      ++m_reordered;
+    }
+    m_last = sequence;
+    m_lastTime = time;
+    ++m_received;
+  }
+
+  uint32_t received() const { return m_received; }
+  uint32_t reordered() const { return m_reordered; }
+  uint64_t first() const { return m_first; }
+  uint64_t last() const { return m_lastTime; }
+
+private:
+  uint32_t m_received = 0;
+  uint32_t m_reordered = 0;
+  uint16_t m_last = 0;
+  uint64_t m_first = 0;
+  uint64_t m_lastTime = 0;
+};
+
+class BurstSender : public TrafficNode
+{
+public:
+  BurstSender(VirtualBus * bus, uint16_t identifier, uint8_t source)
+    : TrafficNode(bus)
+    , m_identifier(identifier)
+    , m_source(source)
+  {
+  }
+
+  void send(uint16_t count) { m_remaining = count; }
+  uint16_t sent() const { return m_sent; }
+
+protected:
+  bool nextFrame(VirtualBus::Frame * frame) override
+  {
+    if(!m_remaining)
+      return false;
+
+    frame->identifier = m_identifier;
+    frame->extended = false;
+    frame->remote = false;
+    fillFrame(frame, m_sent++, m_source);
+    --m_remaining;
+    return true;
+  }
+
+private:
+  uint16_t m_identifier;
+  uint8_t m_source;
+  uint16_t m_remaining = 0;
+  uint16_t m_sent = 0; // handed to the controller
+};
+
+class Sink : public TrafficNode
+{
+public:
+  explicit Sink(VirtualBus * bus) : TrafficNode(bus) {}
+
+  SequenceCheck & check() { return m_check; }
+  uint32_t corrupted() const { return m_corrupted; }
+
+protected:
+  void received(const VirtualBus::Frame & frame) override
+  {
+    if(frame.remote || !frameIntact(frame.data, frame.length))
+    {
+      ++m_corrupted;
+      return;
+    }
+    m_check.record(frame.data[0] | (frame.data[1] << 8), Host::now());
+  }
+
+private:
+  SequenceCheck m_check;
+  uint32_t m_corrupted = 0;
+};
+
+SequenceCheck receiveChecks[PeerCount];
+uint32_t receiveCorrupted;
+
+void recordReceived(const CAN::MessageEvent * message)
+{
+  uint8_t source = message->content[2];
+  if(message->isRTR() || !frameIntact(message->content, message->length()) || source >= PeerCount)
+  {
+    ++receiveCorrupted;
+    return;
+  }
+  receiveChecks[source].record(message->content[0] | (message->content[1] << 8), Host::now());
+}
+
+void startController(VirtualBus * bus, MCP2515Model * controller, uint32_t bitRate)
+{
+  Host::connectSPI(PinNCS, controller);
+  bus->connect(controller);
+
+  const CAN::ReceiveFilter filters[] = {
+    {false, 0, 0},
+    {true, 0, 0}
+  };
+  CAN::start(&recordReceived, nullptr, bitRate);
+  CAN::setReceiveFilters(filters, 2);
+}
+
+// a run fails if frames were reordered or lost without the driver noticing
+bool printResult(const char * name, uint32_t bitRate, uint32_t loopTime, uint32_t sent, uint32_t received,
+                 uint32_t reordered, uint32_t corrupted, uint32_t accounted, uint64_t elapsed, double hostTime)
+{
+  uint32_t lost = sent - received;
+  bool passed = (reordered == 0 && lost == accounted);
+  printf("%-10s %5lu k %6lu %7lu %7lu %6lu %6lu %6lu %8s %8lu %8.0f%s\n", name, (unsigned long)(bitRate / 1000),
+         (unsigned long) loopTime, (unsigned long) sent, (unsigned long) received, (unsigned long) lost,
+         (unsigned long) reordered, (unsigned long) corrupted, (lost == accounted)? "yes" : "NO",
+         (unsigned long)(elapsed? (uint64_t) received * 1000000 / elapsed : 0), received? hostTime / received : 0.0,
+         passed? "" : " FAILED");
+  return passed;
+}
+
+// PeerCount nodes send frameCount frames each as fast as the bus allows; the sketch dispatches from the
+// interrupt (loopTime 0) or polls every loopTime us
+bool receiveBurst(uint32_t bitRate, uint16_t frameCount, uint32_t loopTime)
+{
+  Host::reset();
+  VirtualBus bus(bitRate);
+  MCP2515Model controller(PinNInt);
+  BurstSender peer0(&bus, 0x100, 0);
+  BurstSender peer1(&bus, 0x200, 1);
+  BurstSender peer2(&bus, 0x300, 2);
+  BurstSender * peers[PeerCount] = {&peer0, &peer1, &peer2};
+  Host::attach(&bus);
+
+  startController(&bus, &controller, bitRate);
+  CAN::setPolling(loopTime != 0);
+  for(uint8_t i = 0; i < PeerCount; ++i)
+  {
+    receiveChecks[i] = SequenceCheck();
+    peers[i]->start(bitRate);
+    peers[i]->send(frameCount);
+  }
+  receiveCorrupted = 0;
+
+  auto hostStart = std::chrono::steady_clock::now();
+  uint64_t lastActivity = Host::now();
+  uint32_t lastFrames = 0;
+  while(Host::now() - lastActivity < SettleTime)
+  {
+    CAN::poll();
+    Host::advance(loopTime? loopTime : Host::MaxStep);
+    if(bus.frames() != lastFrames)
+    {
+      lastFrames = bus.frames();
+      lastActivity = Host::now();
+    }
+  }
+  double hostTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - hostStart).count();
+
+  CAN::Stats stats;
+  CAN::getStats(&stats);
+
+  uint32_t sent = 0;
+  uint32_t received = 0;
+  uint32_t reordered = 0;
+  uint64_t first = UINT64_MAX;
+  uint64_t last = 0;
+  for(uint8_t i = 0; i < PeerCount; ++i)
+  {
+    sent += peers[i]->sent();
+    received += receiveChecks[i].received();
+    reordered += receiveChecks[i].reordered();
+    if(receiveChecks[i].received())
+    {
+      first = (receiveChecks[i].first() < first)? receiveChecks[i].first() : first;
+      last = (receiveChecks[i].last() > last)? receiveChecks[i].last() : last;
+    }
+  }
+  uint32_t accounted = stats.receiveDrops + stats.receiveOverruns[0] + stats.receiveOverruns[1];
+  return printResult("receive", bitRate, loopTime, sent, received, reordered, receiveCorrupted, accounted,
+              (last > first)? last - first : 0, hostTime);
+}
+
+// the sketch queues frameCount frames as fast as reserveMessage(SendWait) allows, one node receives them
+bool sendBurst(uint32_t bitRate, uint16_t frameCount, uint32_t loopTime)
+{
+  Host::reset();
+  VirtualBus bus(bitRate);
+  MCP2515Model controller(PinNInt);
+  Sink sink(&bus);
+  Host::attach(&bus);
+
+  startController(&bus, &controller, bitRate);
+  sink.start(bitRate);
+
+  auto hostStart = std::chrono::steady_clock::now();
+  uint16_t sent = 0;
+  uint32_t dropped = 0;
+  while(sent < frameCount)
+  {
+    CAN::MessageEvent * message = CAN::reserveMessage(CAN::SendWait, 100);
+    if(message)
+    {
+      VirtualBus::Frame frame;
+      fillFrame(&frame, sent, 0);
+      message->setStdIdentifier(0x400);
+      message->setLength(frame.length);
+      memcpy(message->content, frame.data, sizeof(message->content));
+      CAN::commitMessage(message);
+    }
+    else
+    {
+      ++dropped;
+    }
+    ++sent;
+    Host::advance(loopTime);
+  }
+
+  uint64_t lastActivity = Host::now();
+  uint32_t lastFrames = 0;
+  while(Host::now() - lastActivity < SettleTime)
+  {
+    Host::advance(Host::MaxStep);
+    if(bus.frames() != lastFrames)
+    {
+      lastFrames = bus.frames();
+      lastActivity = Host::now();
+    }
+  }
+  double hostTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - hostStart).count();
+
+  const SequenceCheck & check = sink.check();
+  return printResult("send", bitRate, loopTime, frameCount, check.received(), check.reordered(), sink.corrupted(), dropped,
+              (check.last() > check.first())? check.last() - check.first() : 0, hostTime);
+}
+
+bool loopbackBenchmark(uint32_t bitRate, uint16_t frameCount)
+{
+  Host::reset();
+  VirtualBus bus(bitRate);
+  MCP2515Model controller(PinNInt);
+  Host::attach(&bus);
+  startController(&bus, &controller, bitRate);
+
+  CAN::BenchmarkResult result;
+  bool passed = CAN::benchmark(frameCount, &result);
+  printf("loopback   %5lu k: %u frames, %u errors, %u frames/s, latency %u / %u / %u us, SPI %u us per frame%s\n",
+         (unsigned long)(bitRate / 1000), result.frames, result.errors, result.framesPerSecond, result.minLatency,
+         result.avgLatency, result.maxLatency, result.spiTime, passed? "" : " FAILED");
+  return passed;
+}
+
+int main(int argc, char ** argv)
+{
+  uint16_t frameCount = (argc > 1)? atoi(argv[1]) : 1000;
+
+  printf("run        bit rate  loop    sent    recv   lost  reord  corr accounted  frame/s  host ns\n");
+  static const uint32_t bitRates[] = {CAN::BitRate125k, CAN::BitRate500k, CAN::BitRate1M};
+  bool passed = true;
+  for(uint32_t bitRate : bitRates)
+  {
+    passed &= receiveBurst(bitRate, frameCount, 0);
+  }
+  passed &= receiveBurst(CAN::BitRate500k, frameCount, 500);
+  passed &= receiveBurst(CAN::BitRate500k, frameCount, 5000);
+  for(uint32_t bitRate : bitRates)
+  {
+    passed &= sendBurst(bitRate, frameCount, 0);
+  }
+  passed &= sendBurst(CAN::BitRate500k, frameCount, 500);
+
+  for(uint32_t bitRate : bitRates)
+  {
+    passed &= loopbackBenchmark(bitRate, frameCount);
+  }
+  return passed? 0 : 1;
+}
@@ -0,0 +1,532 @@
+#include "mcp2515.h"
+
+#include <string.h>
+
+namespace
+{
+  constexpr uint8_t ModeNormal = 0;
+  constexpr uint8_t ModeLoopback = 2;
+  constexpr uint8_t ModeListen = 3;
+  constexpr uint8_t ModeConfig = 4;
+
+  constexpr uint8_t TXREQ = 0x08;
+  constexpr uint8_t ErrorWarningLimit = 96;
+  constexpr uint8_t ErrorPassiveLimit = 128;
+}
+
+MCP2515Model::MCP2515Model(uint8_t interruptPin, uint32_t oscillatorFrequency)
+  : m_interruptPin(interruptPin)
+  , m_oscillatorFrequency(oscillatorFrequency)
+{
+  reset();
+}
+
+// power-on values: configuration mode, everything else cleared
+void MCP2515Model::reset()
+{
+  memset(m_registers, 0, sizeof(m_registers));
+  m_registers[CANCTRL] = 0x87;
+  m_registers[CANSTAT] = 0x80;
+
+  m_state = StateInstruction;
+  m_clearOnDeselect = 0;
+  m_transmitBuffer = -1;
+
+  m_interruptActive = false;
+  if(m_interruptPin != NoPin)
+  {
+    Host::setInput(m_interruptPin, true);
+  }
+}
+
+// CANSTAT and CANCTRL appear at every address ending in 0xE / 0xF
+uint8_t MCP2515Model::readRegister(uint8_t address) const
+{
+  address &= 0x7F;
+  if((address & 0x0F) == 0x0E)
+    return m_registers[CANSTAT];
+  if((address & 0x0F) == 0x0F)
+    return m_registers[CANCTRL];
+  return m_registers[address];
+}
+
+void MCP2515Model::writeRegister(uint8_t address, uint8_t value)
+{
+  storeRegister(address, value);
+}
+
+void MCP2515Model::modifyRegister(uint8_t address, uint8_t mask, uint8_t value)
+{
+  storeRegister(address, (readRegister(address) & ~mask) | (value & mask));
+}
+
+void MCP2515Model::requestToSend(uint8_t buffers)
+{
+  for(uint8_t n = 0; n < 3; ++n)
+  {
+    if(buffers & (0x01 << n))
+    {
+      uint8_t address = TXB0CTRL + 0x10 * n;
+      storeRegister(address, m_registers[address] | TXREQ);
+    }
+  }
+}
+
+// same layout as the receive buffers, except for the RTR bit of standard frames (DLC instead of SIDL.SRR)
+void MCP2515Model::loadTransmitBuffer(uint8_t buffer, const VirtualBus::Frame & frame)
+{
+  uint8_t * registers = m_registers + TXB0CTRL + 0x10 * buffer;
+  uint8_t control = registers[0];
+  encodeFrame(frame, registers);
+  registers[0] = control;
+  registers[2] &= ~0x10;
+  registers[5] = (frame.remote? 0x40 : 0x00) | (frame.length & 0x0F);
+}
+
+bool MCP2515Model::readReceiveBuffer(uint8_t buffer, VirtualBus::Frame * frame)
+{
+  if(!(m_registers[CANINTF] & (RX0IF << buffer)))
+    return false;
+
+  const uint8_t * registers = m_registers + RXB0CTRL + 0x10 * buffer + 1; // SIDH, SIDL, EID8, EID0, DLC, D0 - D7
+  frame->extended = registers[1] & 0x08;
+  frame->identifier = registerIdentifier(registers, frame->extended);
+  frame->remote = frame->extended? (registers[4] & 0x40) : (registers[1] & 0x10);
+  frame->length = registers[4] & 0x0F;
+  memcpy(frame->data, registers + 5, sizeof(frame->data));
+
+  m_registers[CANINTF] &= ~(RX0IF << buffer);
+  updateInterrupt();
+  return true;
+}
+
+bool MCP2515Model::interruptActive() const
+{
+  return m_interruptActive;
+}
+
+void MCP2515Model::select()
+{
+  m_state = StateInstruction;
+  m_clearOnDeselect = 0;
+}
+
+uint8_t MCP2515Model::transfer(uint8_t data)
+{
+  switch(m_state)
+  {
+    case StateInstruction:
+      if(data == 0xC0) // RESET
+      {
+        reset();
+        m_state = StateIgnore;
+      }
+      else if(data == 0x02 || data == 0x03 || data == 0x05) // WRITE, READ, BIT MODIFY
+      {
+        m_nextState = (data == 0x02)? StateWrite : ((data == 0x03)? StateRead : StateModifyMask);
+        m_state = StateAddress;
+      }
+      else if((data & 0xF8) == 0x40 && (data & 0x07) < 6) // LOAD TX BUFFER: 0x40 + 2 * n from TXBnSIDH, + 1 from TXBnD0
+      {
+        m_address = TXB0CTRL + 0x10 * ((data >> 1) & 0x03) + ((data & 0x01)? 6 : 1);
+        m_state = StateWrite;
+      }
+      else if((data & 0xF8) == 0x80) // RTS
+      {
+        requestToSend(data & 0x07);
+        m_state = StateIgnore;
+      }
+      else if((data & 0xF9) == 0x90) // READ RX BUFFER: 0x90 / 0x94 from RXBnSIDH, + 2 from RXBnD0
+      {
+        uint8_t buffer = (data >> 2) & 0x01;
+        m_address = RXB0CTRL + 0x10 * buffer + ((data & 0x02)? 6 : 1);
+        m_clearOnDeselect = RX0IF << buffer;
+        m_state = StateRead;
+      }
+      else if(data == 0xA0) // READ STATUS
+      {
+        m_state = StateStatus;
+      }
+      else
+      {
+        m_state = StateIgnore;
+      }
+      return 0xFF;
+
+    case StateAddress:
+      m_address = data & 0x7F;
+      m_state = m_nextState;
+      return 0xFF;
+
+    case StateRead:
+    {
+      uint8_t value = readRegister(m_address);
+      m_address = (m_address + 1) & 0x7F;
+      return value;
+    }
+
+    case StateWrite:
+      storeRegister(m_address, data);
+      m_address = (m_address + 1) & 0x7F;
+      return 0xFF;
+
+    case StateModifyMask:
+      m_mask = data;
+      m_state = StateModifyData;
+      return 0xFF;
+
+    case StateModifyData:
+      modifyRegister(m_address, m_mask, data);
+      m_state = StateIgnore;
+      return 0xFF;
+
+    case StateStatus:
+      return readStatus(); // repeated as long as the clock runs
+
+    default:
+      return 0xFF;
+  }
+}
+
+void MCP2515Model::deselect()
+{
+  if(m_clearOnDeselect)
+  {
+    m_registers[CANINTF] &= ~m_clearOnDeselect;
+    m_clearOnDeselect = 0;
+    updateInterrupt();
+  }
+  m_state = StateInstruction;
+}
+
+VirtualBus::Mode MCP2515Model::busMode() const
+{
+  switch(opMode())
+  {
+    case ModeNormal:
+      return VirtualBus::ModeNormal;
+    case ModeLoopback:
+      return VirtualBus::ModeLoopback;
+    case ModeListen:
+      return VirtualBus::ModeListenOnly;
+    default:
+      return VirtualBus::ModeOffline;
+  }
+}
+
+// Fosc / (2 * (BRP + 1) * (SyncSeg + PropSeg + PS1 + PS2)), PS2 follows PS1 unless BTLMODE is set
+uint32_t MCP2515Model::bitRate() const
+{
+  uint8_t prescaler = (m_registers[CNF1] & 0x3F) + 1;
+  uint8_t propagation = (m_registers[CNF2] & 0x07) + 1;
+  uint8_t phase1 = ((m_registers[CNF2] >> 3) & 0x07) + 1;
+  uint8_t phase2 = (m_registers[CNF2] & 0x80)? (m_registers[CNF3] & 0x07) + 1 : ((phase1 < 2)? 2 : phase1);
+
+  return m_oscillatorFrequency / (2 * prescaler * (1 + propagation + phase1 + phase2));
+}
+
+// highest TXP first, the higher buffer number among equal priorities
+bool MCP2515Model::pendingFrame(VirtualBus::Frame * frame)
+{
+  int8_t best = -1;
+  uint8_t bestPriority = 0;
+  for(uint8_t n = 0; n < 3; ++n)
+  {
+    uint8_t control = m_registers[TXB0CTRL + 0x10 * n];
+    if(!(control & TXREQ))
+      continue;
+
+    if(best < 0 || (control & 0x03) >= bestPriority)
+    {
+      best = n;
+      bestPriority = control & 0x03;
+    }
+  }
+
+  m_transmitBuffer = best;
+  if(best < 0)
+    return false;
+
+  const uint8_t * registers = m_registers + TXB0CTRL + 0x10 * best + 1; // SIDH, SIDL, EID8, EID0, DLC, D0 - D7
+  frame->extended = registers[1] & 0x08;
+  frame->identifier = registerIdentifier(registers, frame->extended);
+  frame->remote = registers[4] & 0x40;
+  frame->length = registers[4] & 0x0F;
+  memcpy(frame->data, registers + 5, sizeof(frame->data));
+  return true;
+}
+
+void MCP2515Model::transmitted(bool acknowledged)
+{
+  if(m_transmitBuffer < 0)
+    return;
+
+  uint8_t buffer = m_transmitBuffer;
+  m_transmitBuffer = -1;
+
+  uint8_t & control = m_registers[TXB0CTRL + 0x10 * buffer];
+  if(!(control & TXREQ))
+    return; // aborted meanwhile
+
+  if(acknowledged)
+  {
+    control &= ~(TXREQ | 0x10);
+    m_registers[CANINTF] |= TX0IF << buffer;
+    if(m_registers[TEC] > 0)
+    {
+      --m_registers[TEC];
+    }
+  }
+  else
+  {
+    control |= 0x10; // TXERR, TXREQ stays set for the retransmission
+    m_registers[CANINTF] |= MERRF;
+    m_registers[TEC] = (m_registers[TEC] > 255 - 8)? 255 : m_registers[TEC] + 8;
+  }
+
+  updateErrorFlags();
+  updateInterrupt();
+}
+
+// RXB0 first; with BUKT set a frame for the full RXB0 rolls over into RXB1, regardless of the RXB1 filters
+void MCP2515Model::receive(const VirtualBus::Frame & frame)
+{
+  if(busMode() == VirtualBus::ModeOffline)
+    return;
+
+  uint8_t & flags = m_registers[CANINTF];
+  if(accepts(0, frame))
+  {
+    if(!(flags & RX0IF))
+    {
+      storeFrame(0, frame);
+    }
+    else if(m_registers[RXB0CTRL] & 0x04)
+    {
+      if(!(flags & (RX0IF << 1)))
+      {
+        storeFrame(1, frame);
+      }
+      else
+      {
+        overflow(1);
+      }
+    }
+    else
+    {
+      overflow(0);
+    }
+  }
+  else if(accepts(1, frame))
+  {
+    if(!(flags & (RX0IF << 1)))
+    {
+      storeFrame(1, frame);
+    }
+    else
+    {
+      overflow(1);
+    }
+  }
+
+  if(busMode() != VirtualBus::ModeListenOnly && m_registers[REC] > 0)
+  {
+    --m_registers[REC];
+  }
+
+  updateErrorFlags();
+  updateInterrupt();
+}
+
+// the error counters are inactive in listen-only mode
+void MCP2515Model::frameError()
+{
+  if(busMode() == VirtualBus::ModeOffline)
+    return;
+
+  m_registers[CANINTF] |= MERRF;
+  if(busMode() != VirtualBus::ModeListenOnly && m_registers[REC] < 255)
+  {
+    ++m_registers[REC];
+  }
+
+  updateErrorFlags();
+  updateInterrupt();
+}
+
+void MCP2515Model::storeRegister(uint8_t address, uint8_t value)
+{
+  address &= 0x7F;
+  uint8_t & current = m_registers[address];
+
+  if((address & 0x0F) == 0x0E || address == TEC || address == REC)
+    return; // read only
+
+  if((address & 0x0F) == 0x0F)
+  {
+    m_registers[CANCTRL] = value;
+    if(value & 0x10) // ABAT: abort all pending transmissions
+    {
+      for(uint8_t n = 0; n < 3; ++n)
+      {
+        uint8_t & control = m_registers[TXB0CTRL + 0x10 * n];
+        if(control & TXREQ)
+        {
+          control = (control & ~TXREQ) | 0x40; // ABTF
+        }
+      }
+    }
+    m_registers[CANSTAT] = (m_registers[CANSTAT] & 0x1F) | (value & 0xE0); // mode changes take effect at once
+    return;
+  }
+
+  if(address <= CNF1 && address != 0x0C && address != 0x0D && opMode() != ModeConfig)
+    return; // filters, masks and bit timing (all but BFPCTRL, TXRTSCTRL)
+
+  if(address == TXB0CTRL || address == TXB0CTRL + 0x10 || address == TXB0CTRL + 0x20)
+  {
+    // ABTF, MLOA and TXERR are cleared by setting TXREQ
+    current = ((value & TXREQ)? 0x00 : (current & 0x70)) | (value & 0x0B);
+  }
+  else if(address == RXB0CTRL)
+  {
+    current = (current & ~0x64) | (value & 0x64); // RXM, BUKT
+  }
+  else if(address == RXB0CTRL + 0x10)
+  {
+    current = (current & ~0x60) | (value & 0x60); // RXM
+  }
+  else if(address == EFLG)
+  {
+    current = (current & 0x3F) | (value & 0xC0); // RX0OVR, RX1OVR
+  }
+  else
+  {
+    current = value;
+  }
+
+  updateInterrupt();
+}
+
+// RXM = 3: any frame, 1: standard only, 2: extended only, 0: both types, each through the filters of the buffer
+bool MCP2515Model::accepts(uint8_t buffer, const VirtualBus::Frame & frame) const
+{
+  static const uint8_t filters[2][5] = {{0x00, 0x04}, {0x08, 0x10, 0x14, 0x18}};
+  static const uint8_t filterCount[2] = {2, 4};
+
+  uint8_t mode = (m_registers[RXB0CTRL + 0x10 * buffer] >> 5) & 0x03;
+  if(mode == 3)
+    return true;
+  if((mode == 1 && frame.extended) || (mode == 2 && !frame.extended))
+    return false;
+
+  uint32_t mask = registerIdentifier(m_registers + 0x20 + 4 * buffer, frame.extended);
+  for(uint8_t i = 0; i < filterCount[buffer]; ++i)
+  {
+    const uint8_t * filter = m_registers + filters[buffer][i];
+    if(((filter[1] & 0x08) != 0) != frame.extended)
+      continue;
+
+    if(((registerIdentifier(filter, frame.extended) ^ frame.identifier) & mask) == 0)
+      return true;
+  }
+  return false;
+}
+
+void MCP2515Model::storeFrame(uint8_t buffer, const VirtualBus::Frame & frame)
+{
+  encodeFrame(frame, m_registers + RXB0CTRL + 0x10 * buffer);
+  m_registers[CANINTF] |= RX0IF << buffer;
+}
+
+void MCP2515Model::overflow(uint8_t buffer)
+{
+  m_registers[EFLG] |= buffer? 0x80 : 0x40; // RX1OVR, RX0OVR
+  m_registers[CANINTF] |= ERRIF;
+}
+
+// EWARN, RXWAR, TXWAR, RXEP, TXEP; every change raises ERRIF
+void MCP2515Model::updateErrorFlags()
+{
+  uint8_t tec = m_registers[TEC];
+  uint8_t rec = m_registers[REC];
+  uint8_t state = ((tec >= ErrorPassiveLimit)? 0x10 : 0x00) | ((rec >= ErrorPassiveLimit)? 0x08 : 0x00) |
+                  ((tec >= ErrorWarningLimit)? 0x04 : 0x00) | ((rec >= ErrorWarningLimit)? 0x02 : 0x00);
+  if(state)
+  {
+    state |= 0x01;
+  }
+
+  if(state != (m_registers[EFLG] & 0x1F))
+  {
+    m_registers[EFLG] = (m_registers[EFLG] & 0xE0) | state;
+    m_registers[CANINTF] |= ERRIF;
+  }
+}
+
+// INT is active low
+void MCP2515Model::updateInterrupt()
+{
+  bool active = (m_registers[CANINTF] & m_registers[CANINTE]) != 0;
+  if(active == m_interruptActive)
+    return;
+
+  m_interruptActive = active;
+  if(m_interruptPin != NoPin)
+  {
+    Host::setInput(m_interruptPin, !active);
+  }
+}
+
+// RX0IF, RX1IF, TXB0.TXREQ, TX0IF, TXB1.TXREQ, TX1IF, TXB2.TXREQ, TX2IF
+uint8_t MCP2515Model::readStatus() const
+{
+  uint8_t flags = m_registers[CANINTF];
+  uint8_t status = flags & 0x03;
+  for(uint8_t n = 0; n < 3; ++n)
+  {
+    if(m_registers[TXB0CTRL + 0x10 * n] & TXREQ)
+    {
+      status |= 0x04 << (2 * n);
+    }
+    if(flags & (TX0IF << n))
+    {
+      status |= 0x08 << (2 * n);
+    }
+  }
+  return status;
+}
+
+uint32_t MCP2515Model::registerIdentifier(const uint8_t * registers, bool extended)
+{
+  if(extended)
+  {
+    return (((uint32_t) registers[0]) << 21) | (((uint32_t) registers[1] & 0xE0) << 13) |
+           (((uint32_t) registers[1] & 0x03) << 16) | (((uint32_t) registers[2]) << 8) | registers[3];
+  }
+  return (((uint32_t) registers[0]) << 3) | ((registers[1] & 0xE0) >> 5);
+}
+
+// CTRL (RXRTR), SIDH, SIDL, EID8, EID0, DLC, D0 - D7 of a receive buffer
+void MCP2515Model::encodeFrame(const VirtualBus::Frame & frame, uint8_t * registers)
+{
+  uint32_t identifier = frame.identifier;
+  if(frame.extended)
+  {
+    registers[1] = (uint8_t)(identifier >> 21);
+    registers[2] = (uint8_t)(((identifier >> 13) & 0xE0) | 0x08 | ((identifier >> 16) & 0x03)); // IDE
+    registers[3] = (uint8_t)(identifier >> 8);
+    registers[4] = (uint8_t) identifier;
+    registers[5] = (frame.remote? 0x40 : 0x00) | (frame.length & 0x0F); // RTR
+  }
+  else
+  {
+    registers[1] = (uint8_t)(identifier >> 3);
+    registers[2] = (uint8_t)((identifier & 0x07) << 5) | (frame.remote? 0x10 : 0x00); // SRR
+    registers[3] = 0x00;
+    registers[4] = 0x00;
+    registers[5] = frame.length & 0x0F;
+  }
+  memcpy(registers + 6, frame.data, sizeof(frame.data));
+  registers[0] = (registers[0] & ~0x08) | (frame.remote? 0x08 : 0x00);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "virtualbus.h"
+
+// Register level model of the MCP2515 as seen through its SPI interface:
+// RESET, READ, WRITE, BIT MODIFY, LOAD TX BUFFER, RTS, READ RX BUFFER and READ STATUS,
+// the operating modes (configuration registers are write protected outside configuration mode),
+// acceptance filters with rollover from RXB0 to RXB1, receive overflow, transmit priorities,
+// error counters with the EFLG warning / passive flags, and CANINTF / CANINTE driving the INT pin.
+// Not modelled: RX STATUS, bus-off, one-shot mode, sleep / wake-up, filter hits, data byte filtering of standard frames
+// and the RXnBF / TXnRTS pins.
+class MCP2515Model : public Host::SPIDevice, public VirtualBus::Node
+{
+public:
+  static constexpr uint8_t NoPin = 0xFF;
+
+  // register addresses
+  static constexpr uint8_t CANSTAT = 0x0E;
+  static constexpr uint8_t CANCTRL = 0x0F;
+  static constexpr uint8_t TEC = 0x1C;
+  static constexpr uint8_t REC = 0x1D;
+  static constexpr uint8_t CNF3 = 0x28;
+  static constexpr uint8_t CNF2 = 0x29;
+  static constexpr uint8_t CNF1 = 0x2A;
+  static constexpr uint8_t CANINTE = 0x2B;
+  static constexpr uint8_t CANINTF = 0x2C;
+  static constexpr uint8_t EFLG = 0x2D;
+  static constexpr uint8_t TXB0CTRL = 0x30; // TXBn at 0x30 + 0x10 * n
+  static constexpr uint8_t RXB0CTRL = 0x60; // RXBn at 0x60 + 0x10 * n
+
+  // CANINTF
+  static constexpr uint8_t RX0IF = 0x01;
+  static constexpr uint8_t TX0IF = 0x04;
+  static constexpr uint8_t ERRIF = 0x20;
+  static constexpr uint8_t MERRF = 0x80;
+
+  // interruptPin is driven low while an enabled interrupt flag is set
+  explicit MCP2515Model(uint8_t interruptPin = NoPin, uint32_t oscillatorFrequency = 16000000);
+
+  void reset();
+
+  // direct register access, for nodes driven by the simulation instead of a sketch
+  uint8_t readRegister(uint8_t address) const;
+  void writeRegister(uint8_t address, uint8_t value);
+  void modifyRegister(uint8_t address, uint8_t mask, uint8_t value);
+  void requestToSend(uint8_t buffers); // bit n: TXBn
+  void loadTransmitBuffer(uint8_t buffer, const VirtualBus::Frame & frame);
+  bool readReceiveBuffer(uint8_t buffer, VirtualBus::Frame * frame); // false if RXnIF is clear, clears it otherwise
+
+  bool interruptActive() const;
+
+  // Host::SPIDevice
+  void select() override;
+  uint8_t transfer(uint8_t data) override;
+  void deselect() override;
+
+  // VirtualBus::Node
+  VirtualBus::Mode busMode() const override;
+  uint32_t bitRate() const override; // from CNF1 - CNF3
+  bool pendingFrame(VirtualBus::Frame * frame) override;
+  void transmitted(bool acknowledged) override;
+  void receive(const VirtualBus::Frame & frame) override;
+  void frameError() override;
+
+private:
+  enum SPIState : uint8_t
+  {
+    StateInstruction,
+    StateAddress,
+    StateRead,
+    StateWrite,
+    StateModifyMask,
+    StateModifyData,
+    StateStatus,
+    StateIgnore
+  };
+
+  uint8_t opMode() const { return (m_registers[CANSTAT] >> 5) & 0x07; }
+
+  void storeRegister(uint8_t address, uint8_t value); // with write protection and read-only bits
+  bool accepts(uint8_t buffer, const VirtualBus::Frame & frame) const;
+  void storeFrame(uint8_t buffer, const VirtualBus::Frame & frame);
+  void overflow(uint8_t buffer);
+  void updateErrorFlags();
+  void updateInterrupt();
+  uint8_t readStatus() const;
+
+  // SIDH, SIDL, EID8, EID0 as 11 or 29 bit identifier (EXIDE is not evaluated, masks have none)
+  static uint32_t registerIdentifier(const uint8_t * registers, bool extended);
+  static void encodeFrame(const VirtualBus::Frame & frame, uint8_t * registers);
+
+private:
+  uint8_t m_interruptPin;
+  uint32_t m_oscillatorFrequency;
+
+  uint8_t m_registers[0x80];
+
+  SPIState m_state = StateInstruction;
+  SPIState m_nextState; // after the address byte
+  uint8_t m_address;
+  uint8_t m_mask;
+  uint8_t m_clearOnDeselect = 0; // RXnIF of a buffer read with READ RX BUFFER
+
+  int8_t m_transmitBuffer = -1; // returned by the last pendingFrame()
+  bool m_interruptActive = false;
+};
@@ -0,0 +1,59 @@
+#include "trafficnode.h"
+
+TrafficNode::TrafficNode(VirtualBus * bus, uint32_t oscillatorFrequency)
+  : m_controller(MCP2515Model::NoPin, oscillatorFrequency)
+  , m_oscillatorFrequency(oscillatorFrequency)
+{
+  bus->connect(&m_controller);
+  Host::attach(this);
+}
+
+// the segment choices of CANBase::bitTiming()
+bool TrafficNode::start(uint32_t bitRate)
+{
+  static const uint8_t segments[][4] = {{16, 2, 7, 6}, {10, 2, 4, 3}, {8, 1, 3, 3}}; // quanta, PropSeg, PS1, PS2
+
+  for(uint8_t i = 0; i < sizeof(segments) / sizeof(segments[0]); ++i)
+  {
+    uint32_t divider = 2 * segments[i][0] * bitRate;
+    if(m_oscillatorFrequency % divider != 0 || m_oscillatorFrequency / divider == 0 || m_oscillatorFrequency / divider > 64)
+      continue;
+
+    stop();
+    m_controller.writeRegister(MCP2515Model::CNF3, segments[i][3] - 1);
+    m_controller.writeRegister(MCP2515Model::CNF2, 0x80 | ((segments[i][2] - 1) << 3) | (segments[i][1] - 1));
+    m_controller.writeRegister(MCP2515Model::CNF1, m_oscillatorFrequency / divider - 1);
+    m_controller.writeRegister(MCP2515Model::RXB0CTRL, 0x64); // any frame, rollover
+    m_controller.writeRegister(MCP2515Model::RXB0CTRL + 0x10, 0x60);
+    m_controller.writeRegister(MCP2515Model::CANCTRL, 0x00); // normal mode
+    return true;
+  }
+  return false;
+}
+
+void TrafficNode::stop()
+{
+  m_controller.writeRegister(MCP2515Model::CANCTRL, 0x80);
+}
+
+void TrafficNode::advanceTo(uint64_t)
+{
+  VirtualBus::Frame frame;
+  for(uint8_t buffer = 0; buffer < 2; ++buffer)
+  {
+    if(m_controller.readReceiveBuffer(buffer, &frame))
+    {
+      received(frame);
+    }
+  }
+
+  if(m_controller.busMode() != VirtualBus::ModeNormal)
+    return;
+
+  m_controller.modifyRegister(MCP2515Model::CANINTF, MCP2515Model::TX0IF, 0x00);
+  if(!(m_controller.readRegister(MCP2515Model::TXB0CTRL) & 0x08) && nextFrame(&frame)) // TXREQ
+  {
+    m_controller.loadTransmitBuffer(0, frame);
+    m_controller.requestToSend(0x01);
+  }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "mcp2515.h"
+
+// Bus participant without firmware: an MCP2515Model whose registers are accessed directly, without SPI time.
+// Frames from nextFrame() are sent one at a time through TXB0, so they leave in order; received frames
+// (any identifier) are passed to received() as soon as they arrive.
+class TrafficNode : public Host::Peripheral
+{
+public:
+  TrafficNode(VirtualBus * bus, uint32_t oscillatorFrequency = 16000000);
+
+  // configures the bit timing and goes to normal mode, false if bitRate cannot be generated
+  bool start(uint32_t bitRate);
+  void stop(); // configuration mode, off the bus
+
+  MCP2515Model & controller() { return m_controller; }
+
+  void advanceTo(uint64_t now) override;
+
+protected:
+  virtual bool nextFrame(VirtualBus::Frame *) { return false; }
+  virtual void received(const VirtualBus::Frame &) {}
+
+private:
+  MCP2515Model m_controller;
+  uint32_t m_oscillatorFrequency;
+};
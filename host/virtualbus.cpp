@@ -0,0 +1,220 @@
+#include "virtualbus.h"
+
+VirtualBus::VirtualBus(uint32_t bitRate)
+  : m_bitRate(bitRate)
+{
+}
+
+void VirtualBus::connect(VirtualBus::Node * node)
+{
+  if(m_nodeCount < MaxNodes)
+  {
+    m_nodes[m_nodeCount++] = {node, false, 0, {}};
+  }
+}
+
+void VirtualBus::resetCounters()
+{
+  m_frames = 0;
+  m_busyTime = 0;
+}
+
+// SOF to CRC with stuff bits, then CRC delimiter, ACK slot and delimiter, EOF and interframe space
+uint16_t VirtualBus::frameBits(const VirtualBus::Frame & frame)
+{
+  uint8_t bits[128];
+  uint8_t count = 0;
+  auto append = [&](uint32_t value, uint8_t width)
+  {
+    while(width--)
+    {
+      bits[count++] = (value >> width) & 0x01;
+    }
+  };
+
+  uint8_t dataLength = frame.remote? 0 : ((frame.length > 8)? 8 : frame.length);
+
+  append(0, 1); // SOF
+  if(frame.extended)
+  {
+    append(frame.identifier >> 18, 11);
+    append(0b11, 2); // SRR, IDE
+    append(frame.identifier & 0x3FFFF, 18);
+    append(frame.remote, 1);
+    append(0b00, 2); // r1, r0
+  }
+  else
+  {
+    append(frame.identifier, 11);
+    append(frame.remote, 1);
+    append(0b00, 2); // IDE, r0
+  }
+  append(frame.length, 4);
+  for(uint8_t i = 0; i < dataLength; ++i)
+  {
+    append(frame.data[i], 8);
+  }
+
+  uint16_t crc = 0;
+  for(uint8_t i = 0; i < count; ++i)
+  {
+    bool next = bits[i] ^ ((crc >> 14) & 0x01);
+    crc = (crc << 1) & 0x7FFF;
+    if(next)
+    {
+      crc ^= 0x4599;
+    }
+  }
+  append(crc, 15);
+
+  uint8_t stuffBits = 0;
+  uint8_t run = 1;
+  uint8_t level = bits[0];
+  for(uint8_t i = 1; i < count; ++i)
+  {
+    if(bits[i] == level)
+    {
+      ++run;
+    }
+    else
+    {
+      level = bits[i];
+      run = 1;
+    }
+    if(run == 5) // the complementary stuff bit starts the next run
+    {
+      ++stuffBits;
+      level ^= 0x01;
+      run = 1;
+    }
+  }
+
+  return count + stuffBits + 13;
+}
+
+// base identifier, SRR / RTR, IDE, extended identifier, RTR: dominant (0) bits win
+uint32_t VirtualBus::arbitrationKey(const VirtualBus::Frame & frame)
+{
+  if(frame.extended)
+  {
+    return ((frame.identifier >> 18) << 21) | (0x01 << 20) | (0x01 << 19) |
+           ((frame.identifier & 0x3FFFF) << 1) | (frame.remote? 0x01 : 0x00);
+  }
+  return ((frame.identifier & 0x7FF) << 21) | (frame.remote? (0x01 << 20) : 0x00);
+}
+
+void VirtualBus::advanceTo(uint64_t now)
+{
+  for(uint8_t i = 0; i < m_nodeCount; ++i)
+  {
+    advanceLoopback(i, now);
+  }
+
+  bool backToBack = false;
+  for(;;)
+  {
+    if(!m_busy)
+    {
+      if(!backToBack && m_time < now)
+      {
+        m_time = now; // frames requested since the last update start now
+      }
+      startBusFrame();
+      if(!m_busy)
+        return;
+    }
+    if(m_frameEnd > now)
+      return;
+
+    endBusFrame();
+    backToBack = true;
+  }
+}
+
+void VirtualBus::startBusFrame()
+{
+  uint32_t bestKey = 0;
+  for(uint8_t i = 0; i < m_nodeCount; ++i)
+  {
+    Node * node = m_nodes[i].node;
+    Frame frame;
+    if(node->busMode() != ModeNormal || node->bitRate() != m_bitRate || !node->pendingFrame(&frame))
+      continue;
+
+    uint32_t key = arbitrationKey(frame);
+    if(!m_busy || key < bestKey)
+    {
+      m_busy = true;
+      bestKey = key;
+      m_sender = i;
+      m_frame = frame;
+    }
+  }
+
+  if(m_busy)
+  {
+    m_frameEnd = frameEnd(m_time, m_frame, m_bitRate);
+  }
+}
+
+void VirtualBus::endBusFrame()
+{
+  m_busyTime += m_frameEnd - m_time;
+  m_time = m_frameEnd;
+  m_busy = false;
+
+  bool acknowledged = false;
+  for(uint8_t i = 0; i < m_nodeCount; ++i)
+  {
+    Node * node = m_nodes[i].node;
+    Mode mode = node->busMode();
+    if(i == m_sender || mode == ModeOffline || mode == ModeLoopback)
+      continue;
+
+    if(node->bitRate() != m_bitRate)
+    {
+      node->frameError();
+      continue;
+    }
+
+    node->receive(m_frame);
+    acknowledged |= mode == ModeNormal;
+  }
+
+  m_nodes[m_sender].node->transmitted(acknowledged); // retransmitted later if nobody acknowledged
+  if(acknowledged)
+  {
+    ++m_frames;
+  }
+}
+
+// a node in loopback mode receives its own frames after the time they would take on the bus
+void VirtualBus::advanceLoopback(uint8_t index, uint64_t now)
+{
+  NodeState & state = m_nodes[index];
+  uint32_t bitRate = state.node->bitRate();
+
+  bool backToBack = false;
+  for(;;)
+  {
+    if(!state.loopbackActive)
+    {
+      if(state.node->busMode() != ModeLoopback || !bitRate || !state.node->pendingFrame(&state.loopbackFrame))
+        return;
+
+      uint64_t start = (backToBack || state.loopbackEnd > now)? state.loopbackEnd : now;
+      state.loopbackEnd = frameEnd(start, state.loopbackFrame, bitRate);
+      state.loopbackActive = true;
+    }
+    if(state.loopbackEnd > now)
+      return;
+
+    state.loopbackActive = false;
+    if(state.node->busMode() == ModeLoopback)
+    {
+      state.node->receive(state.loopbackFrame);
+    }
+    state.node->transmitted(true);
+    backToBack = true;
+  }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <host.h>
+
+// CAN bus connecting simulated controllers: arbitration by identifier, frame lengths including stuff bits,
+// acknowledgement and per-node loopback. Nodes whose bit rate differs from the bus see every frame as an error
+// (without disturbing the others) and never get to send.
+class VirtualBus : public Host::Peripheral
+{
+public:
+  using Frame = struct
+  {
+    uint32_t identifier; // 11 or 29 bits
+    bool extended;
+    bool remote;
+    uint8_t length; // DLC, 0 - 15 (at most 8 data bytes are sent)
+    uint8_t data[8];
+  };
+
+  enum Mode : uint8_t
+  {
+    ModeOffline, // configuration or sleep mode
+    ModeNormal,
+    ModeListenOnly, // receives, but neither acknowledges nor sends
+    ModeLoopback // sends to itself only
+  };
+
+  class Node
+  {
+  public:
+    virtual Mode busMode() const = 0;
+    virtual uint32_t bitRate() const = 0;
+    virtual bool pendingFrame(Frame * frame) = 0; // the frame the node would send next, if any
+    virtual void transmitted(bool acknowledged) = 0; // end of the frame returned by the last pendingFrame()
+    virtual void receive(const Frame & frame) = 0;
+    virtual void frameError() = 0; // garbled frame, e.g. wrong bit rate
+  };
+
+  static constexpr uint8_t MaxNodes = 8;
+
+  explicit VirtualBus(uint32_t bitRate);
+
+  void connect(Node * node);
+
+  uint32_t bitRate() const { return m_bitRate; }
+
+  uint32_t frames() const { return m_frames; } // acknowledged frames
+  uint64_t busyTime() const { return m_busyTime; } // us
+  void resetCounters();
+
+  // bits from start of frame to the end of interframe space
+  static uint16_t frameBits(const Frame & frame);
+
+  void advanceTo(uint64_t now) override;
+
+private:
+  // arbitration field as a number, the smallest value wins
+  static uint32_t arbitrationKey(const Frame & frame);
+
+  uint64_t frameEnd(uint64_t start, const Frame & frame, uint32_t bitRate) const
+  {
+    return start + ((uint64_t) frameBits(frame) * 1000000 + bitRate - 1) / bitRate;
+  }
+
+  void startBusFrame();
+  void endBusFrame();
+  void advanceLoopback(uint8_t node, uint64_t now);
+
+private:
+  using NodeState = struct
+  {
+    Node * node;
+    bool loopbackActive;
+    uint64_t loopbackEnd;
+    Frame loopbackFrame;
+  };
+
+  uint32_t m_bitRate;
+
+  NodeState m_nodes[MaxNodes];
+  uint8_t m_nodeCount = 0;
+
+  uint64_t m_time = 0; // bus is idle or busy up to here
+  bool m_busy = false;
+  uint8_t m_sender;
+  uint64_t m_frameEnd;
+  Frame m_frame;
+
+  uint32_t m_frames = 0;
+  uint64_t m_busyTime = 0;
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "canbase.h"
+
+
+// Interrupt driven MCP2515 driver with a receive, a send and an error queue of the given sizes
+// (a queue of size n holds up to n - 1 entries). Every sketch instantiates it once, e.g.
+//   using CAN = CANBus<8, 4, 4>;
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+class CANBus : public CANBase
+{
+  static_assert(ReceiveQueueSize >= 2 && SendQueueSize >= 2 && ErrorQueueSize >= 2, "queues need at least 2 entries");
+
+public:
+  // Returns false (without starting) if bitRate cannot be generated from OscillatorFrequency. With listenOnly
+  // the controller goes straight from configuration to listen-only mode and never takes part in the bus traffic.
+  static bool start(MessageHandler * msgHandler = nullptr, ErrorHandler * errorHandler = nullptr,
+                    uint32_t bitRate = BitRate100k, bool listenOnly = false);
+
+  // Up to 3 queued messages are handed to the controller at once, which sends the one with the highest
+  // priority first. Messages of equal priority leave in the order they were queued.
+  // Received messages and errors are passed to the handlers from the interrupt (with interrupts enabled again)
+  // by default. In polling mode the interrupt only queues them and the application dispatches them from loop()
+  // with poll() or fetches them one by one with tryReceive() / tryReceiveError(). start() resets to interrupt mode.
+  static void setPolling(bool polling);
+  static void poll(); // calls the handlers for all queued errors and messages
+  static bool tryReceive(MessageEvent * message, uint32_t * receiveMicros = nullptr); // micros() at reception
+  static bool tryReceiveError(ErrorEvent * error);
+
+  static void getDispatchStats(DispatchStats * stats);
+  static void resetDispatchStats();
+
+  static void getStats(Stats * stats);
+  static void resetStats();
+
+  // What reserveMessage() does if the send queue is full
+  enum SendPolicy : uint8_t
+  {
+    SendDrop, // return nullptr
+    SendWait, // wait up to timeout ms for a free slot (only if interrupts are enabled), then return nullptr
+    SendOverwrite // discard the oldest committed message that was not handed to the controller yet
+  };
+
+  // Reserves a slot in the send queue, which is filled with interrupts enabled and queued for sending by
+  // commitMessage(). Messages are sent in the order of reservation, so a slot that is not committed yet
+  // holds back the ones reserved after it.
+  static MessageEvent * reserveMessage(SendPolicy policy = SendDrop, uint16_t timeout = 0);
+  static bool commitMessage(MessageEvent * message); // message must be a pointer obtained through reserveMessage()
+
+  // Sends frameCount frames through the whole driver path with the controller in loopback mode, first one at a
+  // time (latency), then as fast as the queues allow (frames per second, SPI time). The node is disconnected
+  // from the bus meanwhile, messages received before still reach the message handler and the stats are reset
+  // afterwards.
+  // Returns true if every frame came back intact. Requires interrupts, call after start() and setReceiveFilters().
+  static bool benchmark(uint16_t frameCount, BenchmarkResult * result);
+
+private:
+  CANBus() = default;
+
+  static void onInterrupt();
+
+  static void fillTransmitBuffers();
+  static void receiveMessages(uint8_t iflags);
+
+  static bool sendBenchmarkFrame(uint16_t sequence);
+  // false if no frame is queued, it is corrupted or it is no benchmark frame (passed on to the message handler)
+  static bool receiveBenchmarkFrame(uint16_t * sequence);
+
+  static void recordDispatch(uint8_t index);
+  static void updateRates(uint32_t now);
+
+  // queue indices wrap without a division, the sizes need not be powers of two
+  static uint8_t advance(uint8_t index, uint8_t size)
+  {
+    return (index + 1 < size)? index + 1 : 0;
+  }
+  static uint8_t depth(uint8_t free, uint8_t next, uint8_t size)
+  {
+    return (free >= next)? free - next : free + size - next;
+  }
+
+private:
+  static MessageEvent s_sendQueue[SendQueueSize];
+  static volatile uint8_t s_sendQueueFree;
+  static volatile uint8_t s_sendQueueNext;
+  static volatile uint8_t s_sendPending; // bit n: TXBn is in use
+  static volatile bool s_sendReady[SendQueueSize]; // slot is committed
+
+  static MessageEvent s_receiveQueue[ReceiveQueueSize];
+  static volatile uint8_t s_receiveQueueFree;
+  static volatile uint8_t s_receiveQueueNext;
+  static volatile bool s_handlingMessages;
+  static uint32_t s_receiveMicros[ReceiveQueueSize];
+
+  static volatile bool s_polling;
+  static DispatchStats s_dispatchStats;
+
+  static Stats s_stats;
+  static uint32_t s_rateWindowStart;
+  static uint16_t s_rateWindowReceived;
+  static uint16_t s_rateWindowSent;
+
+  static ErrorEvent s_errorQueue[ErrorQueueSize];
+  static volatile uint8_t s_errorQueueFree;
+  static volatile uint8_t s_errorQueueNext;
+  static volatile bool s_handlingErrors;
+
+  static MessageHandler * s_messageHandler;
+  static ErrorHandler * s_errorHandler;
+};
+
+#include "can_impl.h"
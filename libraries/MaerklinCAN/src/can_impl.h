@@ -0,0 +1,630 @@
+#pragma once
+
+// member definitions of CANBus, included by can.h
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+bool CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::start(CANBase::MessageHandler * msgHandler,
+                                                                 CANBase::ErrorHandler * errorHandler, uint32_t bitRate,
+                                                                 bool listenOnly)
+{
+  uint8_t cnf[3];
+  if(!bitTiming(bitRate, cnf))
+    return false;
+
+  cli();
+
+  s_sendQueueFree = 0;
+  s_sendQueueNext = 0;
+  s_sendPending = 0;
+  for(uint8_t i = 0; i < SendQueueSize; ++i)
+  {
+    s_sendReady[i] = false;
+  }
+
+  s_receiveQueueFree = 0;
+  s_receiveQueueNext = 0;
+  s_handlingMessages = false;
+  s_polling = false;
+  resetDispatchStats();
+  resetStats();
+
+  s_errorQueueFree = 0;
+  s_errorQueueNext = 0;
+  s_handlingErrors = false;
+
+  s_messageHandler = msgHandler;
+  s_errorHandler = errorHandler;
+
+  resetController();
+  attachInterrupt(digitalPinToInterrupt(PinNInt), &onInterrupt, FALLING);
+
+  configure(cnf, listenOnly);
+
+  sei();
+  return true;
+}
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+CANBase::MessageEvent * CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::reserveMessage(SendPolicy policy, uint16_t timeout)
+{
+  uint32_t start = millis();
+  uint8_t SaveSREG = SREG;
+  cli();
+
+  while(advance(s_sendQueueFree, SendQueueSize) == s_sendQueueNext) // send queue full
+  {
+    if(policy == SendOverwrite && s_sendReady[s_sendQueueNext])
+    {
+      s_sendReady[s_sendQueueNext] = false;
+      s_sendQueueNext = advance(s_sendQueueNext, SendQueueSize);
+      countEvent(s_stats.sendDrops);
+      break;
+    }
+
+    if(policy != SendWait || !(SaveSREG & 0x80) || millis() - start >= timeout) // 0x80: I bit
+    {
+      countEvent(s_stats.sendDrops);
+      SREG = SaveSREG;
+      return nullptr;
+    }
+
+    // let the transmit interrupt free a slot (and Timer0 advance millis()): the AVR executes one more
+    // instruction after setting the I bit before it takes a pending interrupt
+    SREG = SaveSREG;
+    __asm__ __volatile__("nop");
+    cli();
+  }
+
+  MessageEvent * message = s_sendQueue + s_sendQueueFree;
+  s_sendQueueFree = advance(s_sendQueueFree, SendQueueSize);
+  SREG = SaveSREG;
+
+  message->control = 0;
+  return message;
+}
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+bool CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::commitMessage(CANBase::MessageEvent * message)
+{
+  if(message < s_sendQueue || message >= s_sendQueue + SendQueueSize)
+    return false;
+
+  uint8_t SaveSREG = SREG;
+  cli();
+
+  s_sendReady[message - s_sendQueue] = true;
+
+  uint8_t queued = depth(s_sendQueueFree, s_sendQueueNext, SendQueueSize);
+  if(queued > s_stats.sendHighWater)
+  {
+    s_stats.sendHighWater = queued;
+  }
+
+  fillTransmitBuffers();
+
+  SREG = SaveSREG;
+  return true;
+}
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+void CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::onInterrupt()
+{
+  // handle all pending interrupt sources until the controller releases the interrupt line,
+  // otherwise no further falling edge would be detected
+  for(;;)
+  {
+    uint8_t status = readStatus();
+    uint8_t rxFlags = status & 0x03; // RX0IF, RX1IF
+    uint8_t txFlags = ((status >> 3) & 0x01) | ((status >> 4) & 0x02) | ((status >> 5) & 0x04); // TX0IF - TX2IF
+
+    if(rxFlags)
+    {
+      receiveMessages(rxFlags); // reading a receive buffer clears its RXnIF
+    }
+
+    if(txFlags)
+    {
+      bitModify(0x2C, txFlags << 2, 0x00); // clear handled TXnIF in CANINTF
+      s_sendPending &= ~txFlags;
+      s_rateWindowSent += (txFlags & 0x01) + ((txFlags >> 1) & 0x01) + ((txFlags >> 2) & 0x01);
+      updateRates(millis());
+      fillTransmitBuffers();
+    }
+
+    if(rxFlags || txFlags)
+      continue;
+
+    if(digitalRead(PinNInt) == HIGH)
+      break;
+
+    // slow path: the remaining interrupt source is not part of READ STATUS
+    uint8_t statusCommand[] = {0x03, 0x2C, 0x00, 0x00}; // read CANINTF and EFLG
+    canCommand(statusCommand, sizeof(statusCommand));
+    uint8_t iflags = statusCommand[2];
+    uint8_t eflags = statusCommand[3];
+
+    if(!(iflags & 0xA0)) // neither ERRIF nor MERRF: source was handled in the meantime or is not enabled
+      break;
+
+    if(iflags & 0x80) // MERRF: error while sending or receiving a frame
+    {
+      countEvent(s_stats.messageErrors);
+      bitModify(0x2C, 0x80, 0x00); // clear MERRF in CANINTF
+    }
+
+    if(!(iflags & 0x20))
+      continue;
+
+    if(advance(s_errorQueueFree, ErrorQueueSize) != s_errorQueueNext)
+    {
+      s_errorQueue[s_errorQueueFree].timestamp = millis();
+      s_errorQueue[s_errorQueueFree].flags = eflags;
+      s_errorQueueFree = advance(s_errorQueueFree, ErrorQueueSize);
+
+      uint8_t queued = depth(s_errorQueueFree, s_errorQueueNext, ErrorQueueSize);
+      if(queued > s_stats.errorHighWater)
+      {
+        s_stats.errorHighWater = queued;
+      }
+    }
+    else
+    {
+      countEvent(s_stats.errorDrops); // error queue overflow: error will be lost
+    }
+
+    if(eflags & 0x40)
+    {
+      countEvent(s_stats.receiveOverruns[0]);
+    }
+    if(eflags & 0x80)
+    {
+      countEvent(s_stats.receiveOverruns[1]);
+    }
+
+    bitModify(0x2D, 0xC0, 0x00); // clear RX0OVR, RX1OVR in EFLG
+    bitModify(0x2C, 0x20, 0x00); // clear ERRIF in CANINTF
+  }
+
+  if(s_polling)
+    return; // handlers are called from poll()
+
+  if(!s_handlingErrors)
+  {
+    s_handlingErrors = true;
+    while(s_errorQueueNext != s_errorQueueFree)
+    {
+      if(s_errorHandler)
+      {
+        sei();
+        s_errorHandler(s_errorQueue + s_errorQueueNext);
+        cli();
+      }
+      s_errorQueueNext = advance(s_errorQueueNext, ErrorQueueSize);
+    }
+    s_handlingErrors = false;
+  }
+
+  if(!s_handlingMessages)
+  {
+    s_handlingMessages = true;
+    while(s_receiveQueueNext != s_receiveQueueFree)
+    {
+      recordDispatch(s_receiveQueueNext);
+      if(s_messageHandler)
+      {
+        sei();
+        s_messageHandler(s_receiveQueue + s_receiveQueueNext);
+        cli();
+      }
+      s_receiveQueueNext = advance(s_receiveQueueNext, ReceiveQueueSize);
+    }
+    s_handlingMessages = false;
+  }
+}
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+void CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::setPolling(bool polling)
+{
+  uint8_t SaveSREG = SREG;
+  cli();
+  s_polling = polling;
+  SREG = SaveSREG;
+}
+
+// single consumer of the error and receive queues, the interrupt only advances the free indices
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+void CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::poll()
+{
+  if(!s_polling)
+    return;
+
+  while(s_errorQueueNext != s_errorQueueFree)
+  {
+    if(s_errorHandler)
+    {
+      s_errorHandler(s_errorQueue + s_errorQueueNext);
+    }
+    s_errorQueueNext = advance(s_errorQueueNext, ErrorQueueSize);
+  }
+
+  while(s_receiveQueueNext != s_receiveQueueFree)
+  {
+    uint8_t SaveSREG = SREG;
+    cli();
+    recordDispatch(s_receiveQueueNext);
+    SREG = SaveSREG;
+
+    if(s_messageHandler)
+    {
+      s_messageHandler(s_receiveQueue + s_receiveQueueNext);
+    }
+    s_receiveQueueNext = advance(s_receiveQueueNext, ReceiveQueueSize);
+  }
+}
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+bool CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::tryReceive(CANBase::MessageEvent * message, uint32_t * receiveMicros)
+{
+  if(!s_polling || s_receiveQueueNext == s_receiveQueueFree)
+    return false;
+
+  uint8_t SaveSREG = SREG;
+  cli();
+  recordDispatch(s_receiveQueueNext);
+  SREG = SaveSREG;
+
+  *message = s_receiveQueue[s_receiveQueueNext];
+  if(receiveMicros)
+  {
+    *receiveMicros = s_receiveMicros[s_receiveQueueNext];
+  }
+  s_receiveQueueNext = advance(s_receiveQueueNext, ReceiveQueueSize);
+  return true;
+}
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+bool CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::tryReceiveError(CANBase::ErrorEvent * error)
+{
+  if(!s_polling || s_errorQueueNext == s_errorQueueFree)
+    return false;
+
+  *error = s_errorQueue[s_errorQueueNext];
+  s_errorQueueNext = advance(s_errorQueueNext, ErrorQueueSize);
+  return true;
+}
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+bool CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::benchmark(uint16_t frameCount, CANBase::BenchmarkResult * result)
+{
+  memset(result, 0, sizeof(*result));
+  result->minLatency = UINT16_MAX;
+
+  bool polling = s_polling;
+  setPolling(true); // the handlers will not see the benchmark frames
+  setMode(ModeLoopback); // no bus frames from here on, the receive buffers may be opened
+
+  uint8_t bufferCommand[] = {0x03, 0x60, 0x00}; // read RXB0CTRL
+  canCommand(bufferCommand, sizeof(bufferCommand));
+  uint8_t rxb0Control = bufferCommand[2];
+  bufferCommand[1] = 0x70; // RXB1CTRL
+  canCommand(bufferCommand, sizeof(bufferCommand));
+  uint8_t rxb1Control = bufferCommand[2];
+
+  bitModify(0x60, 0x60, 0x60); // RXB0: receive any message
+  bitModify(0x70, 0x60, 0x60); // RXB1: receive any message
+
+  // one frame at a time
+  uint32_t totalLatency = 0;
+  for(uint16_t i = 0; i < frameCount; ++i)
+  {
+    uint32_t start = micros();
+    uint16_t sequence = i + 1; // anything but i
+    if(sendBenchmarkFrame(i))
+    {
+      while(!receiveBenchmarkFrame(&sequence) && micros() - start < 10000);
+    }
+    uint32_t latency = micros() - start;
+    if(sequence != i)
+    {
+      ++result->errors;
+      continue;
+    }
+
+    ++result->frames;
+    totalLatency += latency;
+    if(latency < result->minLatency)
+    {
+      result->minLatency = latency;
+    }
+    if(latency > result->maxLatency)
+    {
+      result->maxLatency = latency;
+    }
+  }
+  result->avgLatency = result->frames? totalLatency / result->frames : 0;
+
+  // all queues filled
+  s_spiTime = 0;
+  s_measureSpi = true;
+  uint32_t start = micros();
+  uint32_t lastReceived = start;
+  uint16_t sent = 0;
+  uint16_t intact = 0;
+  while(intact < frameCount && micros() - lastReceived < 10000)
+  {
+    if(sent < frameCount && sendBenchmarkFrame(sent))
+    {
+      ++sent;
+    }
+
+    uint16_t sequence;
+    if(receiveBenchmarkFrame(&sequence) && sequence < sent)
+    {
+      ++intact;
+      lastReceived = micros();
+    }
+  }
+  uint32_t elapsed = lastReceived - start;
+  s_measureSpi = false;
+  result->errors += frameCount - intact;
+  result->framesPerSecond = elapsed? (uint16_t)((uint32_t) intact * 1000000 / elapsed) : 0;
+  result->spiTime = intact? s_spiTime / intact : 0;
+
+  while(s_receiveQueueNext != s_receiveQueueFree)
+  {
+    uint16_t sequence;
+    receiveBenchmarkFrame(&sequence); // late frames
+  }
+
+  setMode(ModeConfig);
+  uint8_t restoreCommand[] = {0x02, 0x60, rxb0Control};
+  canCommand(restoreCommand, sizeof(restoreCommand));
+  restoreCommand[1] = 0x70;
+  restoreCommand[2] = rxb1Control;
+  canCommand(restoreCommand, sizeof(restoreCommand));
+  setMode(operatingMode());
+
+  poll(); // frames received since the buffers were restored
+  setPolling(polling);
+  resetStats();
+  resetDispatchStats();
+  return result->errors == 0;
+}
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+bool CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::sendBenchmarkFrame(uint16_t sequence)
+{
+  MessageEvent * message = reserveMessage();
+  if(!message)
+    return false;
+
+  message->setExtIdentifier(BenchmarkIdentifier);
+  message->setLength(8);
+  message->content[0] = (uint8_t) (sequence & 0x00FF);
+  message->content[1] = (uint8_t)((sequence & 0xFF00) >> 8);
+  for(uint8_t i = 2; i < 8; ++i)
+  {
+    message->content[i] = message->content[i - 2] ^ 0x55;
+  }
+  return commitMessage(message);
+}
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+bool CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::receiveBenchmarkFrame(uint16_t * sequence)
+{
+  MessageEvent message;
+  if(!tryReceive(&message))
+    return false;
+
+  if(!message.hasExtIdentifier() || message.extIdentifier() != BenchmarkIdentifier)
+  {
+    if(s_messageHandler)
+    {
+      s_messageHandler(&message); // received before the switch to loopback
+    }
+    return false;
+  }
+  if(message.length() != 8)
+    return false;
+  for(uint8_t i = 2; i < 8; ++i)
+  {
+    if(message.content[i] != (message.content[i - 2] ^ 0x55))
+      return false;
+  }
+
+  *sequence = (((uint16_t) message.content[1]) << 8) | message.content[0];
+  return true;
+}
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+void CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::getDispatchStats(CANBase::DispatchStats * stats)
+{
+  uint8_t SaveSREG = SREG;
+  cli();
+  *stats = s_dispatchStats;
+  SREG = SaveSREG;
+}
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+void CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::resetDispatchStats()
+{
+  uint8_t SaveSREG = SREG;
+  cli();
+  s_dispatchStats.count = 0;
+  s_dispatchStats.maxLatency = 0;
+  s_dispatchStats.totalLatency = 0;
+  SREG = SaveSREG;
+}
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+void CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::getStats(CANBase::Stats * stats)
+{
+  uint8_t tec;
+  uint8_t rec;
+  readErrorCounters(&tec, &rec);
+
+  uint8_t SaveSREG = SREG;
+  cli();
+  updateRates(millis());
+  *stats = s_stats;
+  SREG = SaveSREG;
+
+  stats->transmitErrors = tec;
+  stats->receiveErrors = rec;
+}
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+void CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::resetStats()
+{
+  uint8_t SaveSREG = SREG;
+  cli();
+  memset(&s_stats, 0, sizeof(s_stats));
+  s_rateWindowStart = millis();
+  s_rateWindowReceived = 0;
+  s_rateWindowSent = 0;
+  SREG = SaveSREG;
+}
+
+// interrupts must be disabled
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+void CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::recordDispatch(uint8_t index)
+{
+  uint32_t latency = micros() - s_receiveMicros[index];
+  ++s_dispatchStats.count;
+  s_dispatchStats.totalLatency += latency;
+  if(latency > s_dispatchStats.maxLatency)
+  {
+    s_dispatchStats.maxLatency = latency;
+  }
+}
+
+// interrupts must be disabled
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+void CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::updateRates(uint32_t now)
+{
+  uint32_t elapsed = now - s_rateWindowStart;
+  if(elapsed < 1000)
+    return;
+
+  s_stats.receiveRate = (uint16_t)(((uint32_t) s_rateWindowReceived * 1000) / elapsed);
+  s_stats.sendRate = (uint16_t)(((uint32_t) s_rateWindowSent * 1000) / elapsed);
+  s_rateWindowStart = now;
+  s_rateWindowReceived = 0;
+  s_rateWindowSent = 0;
+}
+
+// interrupts must be disabled
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+void CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::fillTransmitBuffers()
+{
+  // Of pending buffers with equal TXP the controller sends the highest one first, so a message has to go below
+  // every pending buffer of its priority to leave after the messages queued before it.
+  while(s_sendQueueNext != s_sendQueueFree && s_sendReady[s_sendQueueNext])
+  {
+    uint8_t priority = s_sendQueue[s_sendQueueNext].priority();
+    uint8_t limit = TransmitBufferCount;
+    for(uint8_t buffer = 0; buffer < TransmitBufferCount; ++buffer)
+    {
+      if((s_sendPending & (0x01 << buffer)) && s_sendBufferPriority[buffer] == priority)
+      {
+        limit = buffer;
+        break;
+      }
+    }
+
+    uint8_t buffer = limit;
+    while(buffer > 0 && (s_sendPending & (0x01 << (buffer - 1))))
+    {
+      --buffer;
+    }
+    if(buffer == 0)
+      return; // no free buffer below limit: wait for the next TXnIF
+
+    --buffer;
+    s_sendPending |= (0x01 << buffer);
+    sendMessage(s_sendQueue + s_sendQueueNext, buffer);
+    s_sendReady[s_sendQueueNext] = false;
+    s_sendQueueNext = advance(s_sendQueueNext, SendQueueSize);
+  }
+}
+
+// RXB0 is read before RXB1, since with rollover it holds the older message
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+void CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::receiveMessages(uint8_t iflags)
+{
+  for(uint8_t buffer = 0; buffer < 2; ++buffer)
+  {
+    if(!(iflags & (0x01 << buffer))) // RXnIF
+      continue;
+
+    if(advance(s_receiveQueueFree, ReceiveQueueSize) != s_receiveQueueNext)
+    {
+      receiveMessage(s_receiveQueue + s_receiveQueueFree, buffer);
+      s_receiveMicros[s_receiveQueueFree] = micros();
+      s_receiveQueueFree = advance(s_receiveQueueFree, ReceiveQueueSize);
+
+      uint8_t queued = depth(s_receiveQueueFree, s_receiveQueueNext, ReceiveQueueSize);
+      if(queued > s_stats.receiveHighWater)
+      {
+        s_stats.receiveHighWater = queued;
+      }
+    }
+    else
+    {
+      countEvent(s_stats.receiveDrops); // message queue overflow: message will be lost
+      bitModify(0x2C, 0x01 << buffer, 0x00); // release RXBn by clearing RXnIF
+    }
+    ++s_rateWindowReceived;
+  }
+  updateRates(millis());
+}
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+CANBase::MessageEvent CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_sendQueue[SendQueueSize];
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+volatile uint8_t CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_sendQueueFree;
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+volatile uint8_t CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_sendQueueNext;
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+volatile uint8_t CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_sendPending;
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+volatile bool CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_sendReady[SendQueueSize];
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+CANBase::MessageEvent CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_receiveQueue[ReceiveQueueSize];
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+volatile uint8_t CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_receiveQueueFree;
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+volatile uint8_t CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_receiveQueueNext;
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+volatile bool CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_handlingMessages;
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+uint32_t CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_receiveMicros[ReceiveQueueSize];
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+volatile bool CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_polling;
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+CANBase::DispatchStats CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_dispatchStats;
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+CANBase::Stats CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_stats;
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+uint32_t CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_rateWindowStart;
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+uint16_t CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_rateWindowReceived;
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+uint16_t CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_rateWindowSent;
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+CANBase::ErrorEvent CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_errorQueue[ErrorQueueSize];
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+volatile uint8_t CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_errorQueueFree;
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+volatile uint8_t CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_errorQueueNext;
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+volatile bool CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_handlingErrors;
+
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+CANBase::MessageHandler * CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_messageHandler;
+template<uint8_t ReceiveQueueSize, uint8_t SendQueueSize, uint8_t ErrorQueueSize>
+CANBase::ErrorHandler * CANBus<ReceiveQueueSize, SendQueueSize, ErrorQueueSize>::s_errorHandler;
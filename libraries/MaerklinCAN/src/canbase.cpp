@@ -0,0 +1,471 @@
+#include "canbase.h"
+
+const SPISettings CANBase::SPIConfig(10000000, MSBFIRST, SPI_MODE0);
+
+void CANBase::setReceiveFilter(CANBase::StdIdentifier identifier, CANBase::StdIdentifier mask)
+{
+  ReceiveFilter filter = {false, identifier, mask};
+  setReceiveFilters(&filter, 1);
+}
+
+void CANBase::setReceiveFilter(CANBase::ExtIdentifier identifier, CANBase::ExtIdentifier mask)
+{
+  ReceiveFilter filter = {true, identifier, mask};
+  setReceiveFilters(&filter, 1);
+}
+
+bool CANBase::setReceiveFilters(const CANBase::ReceiveFilter * filters, uint8_t count)
+{
+  if(count == 0 || count > ReceiveFilterCount)
+    return false;
+
+  // collect the distinct masks
+  uint8_t masks[2][4];
+  uint8_t maskCount = 0;
+  uint8_t filterMask[ReceiveFilterCount];
+  uint8_t maskUsage[2] = {0, 0};
+  for(uint8_t i = 0; i < count; ++i)
+  {
+    uint8_t mask[4];
+    encodeIdentifier(filters[i].hasExtIdentifier, filters[i].mask, mask);
+    mask[1] &= ~0x08; // no EXIDE bit in mask registers
+
+    uint8_t m = 0;
+    while(m < maskCount && memcmp(masks[m], mask, sizeof(mask)) != 0)
+    {
+      ++m;
+    }
+    if(m == maskCount)
+    {
+      if(maskCount == 2)
+        return false; // only RXM0 and RXM1 available
+      memcpy(masks[maskCount++], mask, sizeof(mask));
+    }
+    filterMask[i] = m;
+    ++maskUsage[m];
+  }
+
+  // RXM0 applies to RXF0 - RXF1 (RXB0), RXM1 to RXF2 - RXF5 (RXB1)
+  uint8_t rxb0Mask = (maskCount == 2 && maskUsage[1] < maskUsage[0])? 1 : 0;
+  if(maskCount == 1)
+  {
+    memcpy(masks[1], masks[0], sizeof(masks[0]));
+  }
+  else if(maskUsage[rxb0Mask] > 2 || maskUsage[rxb0Mask ^ 1] > 4)
+  {
+    return false; // RXB0 has 2 filters, RXB1 has 4
+  }
+
+  uint8_t filterRegisters[ReceiveFilterCount][4];
+  uint8_t rxb0Count = 0;
+  uint8_t rxb1Count = 0;
+  for(uint8_t i = 0; i < count; ++i)
+  {
+    uint8_t slot;
+    if(maskCount == 1 && i >= 2)
+    {
+      slot = 2 + rxb1Count++; // single mask: fill RXF0 - RXF5 in order
+    }
+    else if(filterMask[i] == rxb0Mask)
+    {
+      slot = rxb0Count++;
+    }
+    else
+    {
+      slot = 2 + rxb1Count++;
+    }
+    encodeIdentifier(filters[i].hasExtIdentifier, filters[i].identifier, filterRegisters[slot]);
+  }
+
+  // unused filters repeat a filter with the same mask, RXB1 falls back to the filters of RXB0
+  for(uint8_t slot = rxb0Count; slot < 2; ++slot)
+  {
+    memcpy(filterRegisters[slot], filterRegisters[0], sizeof(filterRegisters[0]));
+  }
+  if(rxb1Count == 0)
+  {
+    memcpy(masks[rxb0Mask ^ 1], masks[rxb0Mask], sizeof(masks[0]));
+  }
+  for(uint8_t slot = 2 + rxb1Count; slot < ReceiveFilterCount; ++slot)
+  {
+    memcpy(filterRegisters[slot], filterRegisters[rxb1Count? 2 : 0], sizeof(filterRegisters[0]));
+  }
+
+  setMode(ModeConfig);
+
+  static const uint8_t filterAddresses[ReceiveFilterCount] = {0x00, 0x04, 0x08, 0x10, 0x14, 0x18};
+  for(uint8_t slot = 0; slot < ReceiveFilterCount; ++slot)
+  {
+    uint8_t filterCommand[] = {0x02, filterAddresses[slot],
+      filterRegisters[slot][0], filterRegisters[slot][1], filterRegisters[slot][2], filterRegisters[slot][3]};
+    canCommand(filterCommand, sizeof(filterCommand)); //set RXFn
+  }
+
+  uint8_t maskCommand[] = {0x02, 0x20,
+    masks[rxb0Mask][0], masks[rxb0Mask][1], masks[rxb0Mask][2], masks[rxb0Mask][3],
+    masks[rxb0Mask ^ 1][0], masks[rxb0Mask ^ 1][1], masks[rxb0Mask ^ 1][2], masks[rxb0Mask ^ 1][3]};
+  canCommand(maskCommand, sizeof(maskCommand)); //set RXM0, RXM1
+
+  uint8_t buffer0Command[] = {0x02, 0x60, 0x04};
+  canCommand(buffer0Command, sizeof(buffer0Command)); //enable RXB0, roll over to RXB1 (BUKT)
+
+  uint8_t buffer1Command[] = {0x02, 0x70, 0x00};
+  canCommand(buffer1Command, sizeof(buffer1Command)); //enable RXB1
+
+  setMode(operatingMode());
+  return true;
+}
+
+void CANBase::setListenOnly(bool listenOnly)
+{
+  s_listenOnly = listenOnly;
+  setMode(operatingMode());
+}
+
+void CANBase::clearReceiveFilter()
+{
+  setMode(ModeConfig);
+
+  static const uint8_t filterAddresses[ReceiveFilterCount] = {0x00, 0x04, 0x08, 0x10, 0x14, 0x18};
+  for(uint8_t slot = 0; slot < ReceiveFilterCount; ++slot)
+  {
+    uint8_t filterCommand[] = {0x02, filterAddresses[slot], 0x00, 0x08};
+    canCommand(filterCommand, sizeof(filterCommand)); //set RXFn to accept extended messages
+  }
+
+  uint8_t buffer0Command[] = {0x02, 0x60, 0x20};
+  canCommand(buffer0Command, sizeof(buffer0Command)); //enable RXB0 to accept only standard messages
+
+  uint8_t buffer1Command[] = {0x02, 0x70, 0x20};
+  canCommand(buffer1Command, sizeof(buffer1Command)); //enable RXB1 to accept only standard messages
+
+  setMode(operatingMode());
+}
+
+uint32_t CANBase::detectBitRate(uint16_t timeout)
+{
+  static const uint32_t bitRates[] = {BitRate100k, BitRate125k, BitRate250k, BitRate500k, BitRate1M};
+
+  resetController(); // configuration mode, all interrupts disabled
+
+  uint8_t receiveCommand[] = {0x02, 0x60, 0x60}; // RXB0CTRL: receive any message
+  canCommand(receiveCommand, sizeof(receiveCommand));
+  receiveCommand[1] = 0x70; // RXB1CTRL
+  canCommand(receiveCommand, sizeof(receiveCommand));
+
+  uint32_t detected = 0;
+  for(uint8_t i = 0; i < sizeof(bitRates) / sizeof(bitRates[0]) && !detected; ++i)
+  {
+    uint8_t cnf[3];
+    if(!bitTiming(bitRates[i], cnf))
+      continue;
+
+    uint8_t timingCommand[] = {0x02, 0x28, cnf[0], cnf[1], cnf[2]}; // write CNF3, CNF2, CNF1
+    canCommand(timingCommand, sizeof(timingCommand));
+    bitModify(0x2C, 0xFF, 0x00); // clear CANINTF
+
+    setMode(ModeListen);
+    uint32_t start = millis();
+    while(millis() - start < timeout)
+    {
+      uint8_t flagCommand[] = {0x03, 0x2C, 0x00}; // read CANINTF
+      canCommand(flagCommand, sizeof(flagCommand));
+      if(flagCommand[2] & 0x80) // MERRF: frame error, wrong bit rate
+        break;
+      if(flagCommand[2] & 0x03) // RX0IF, RX1IF: valid frame
+      {
+        detected = bitRates[i];
+        break;
+      }
+    }
+    setMode(ModeConfig);
+  }
+
+  return detected;
+}
+
+// frame 0: drops (receive, send, error), TEC, REC
+// frame 1: RX0 overruns, RX1 overruns, receive rate, send rate
+// frame 2: high-water marks (receive, send, error), message errors
+// 16 bit values are little endian
+uint8_t CANBase::encodeStats(const CANBase::Stats * stats, uint8_t frameNo, uint8_t * content)
+{
+  uint16_t values[4];
+  switch(frameNo)
+  {
+    case 0:
+      values[0] = stats->receiveDrops;
+      values[1] = stats->sendDrops;
+      values[2] = stats->errorDrops;
+      values[3] = (((uint16_t) stats->receiveErrors) << 8) | stats->transmitErrors;
+      break;
+    case 1:
+      values[0] = stats->receiveOverruns[0];
+      values[1] = stats->receiveOverruns[1];
+      values[2] = stats->receiveRate;
+      values[3] = stats->sendRate;
+      break;
+    default:
+      content[0] = stats->receiveHighWater;
+      content[1] = stats->sendHighWater;
+      content[2] = stats->errorHighWater;
+      content[3] = (uint8_t) (stats->messageErrors & 0x00FF);
+      content[4] = (uint8_t)((stats->messageErrors & 0xFF00) >> 8);
+      return 5;
+  }
+
+  for(uint8_t i = 0; i < 4; ++i)
+  {
+    content[2 * i] = (uint8_t) (values[i] & 0x00FF);
+    content[2 * i + 1] = (uint8_t)((values[i] & 0xFF00) >> 8);
+  }
+  return 8;
+}
+
+void CANBase::decodeStats(uint8_t frameNo, const uint8_t * content, CANBase::Stats * stats)
+{
+  uint16_t values[4];
+  for(uint8_t i = 0; i < 4; ++i)
+  {
+    values[i] = (((uint16_t) content[2 * i + 1]) << 8) | content[2 * i];
+  }
+
+  switch(frameNo)
+  {
+    case 0:
+      stats->receiveDrops = values[0];
+      stats->sendDrops = values[1];
+      stats->errorDrops = values[2];
+      stats->transmitErrors = content[6];
+      stats->receiveErrors = content[7];
+      break;
+    case 1:
+      stats->receiveOverruns[0] = values[0];
+      stats->receiveOverruns[1] = values[1];
+      stats->receiveRate = values[2];
+      stats->sendRate = values[3];
+      break;
+    default:
+      stats->receiveHighWater = content[0];
+      stats->sendHighWater = content[1];
+      stats->errorHighWater = content[2];
+      stats->messageErrors = (((uint16_t) content[4]) << 8) | content[3];
+      break;
+  }
+}
+
+// 16, 10 or 8 time quanta per bit, whichever divides the oscillator frequency exactly (with BRP <= 63)
+bool CANBase::bitTiming(uint32_t bitRate, uint8_t * cnf)
+{
+  using Segments = struct
+  {
+    uint8_t quanta;
+    uint8_t propagation;
+    uint8_t phase1;
+    uint8_t phase2;
+  };
+  static const Segments segments[] = {{16, 2, 7, 6}, {10, 2, 4, 3}, {8, 1, 3, 3}};
+
+  if(bitRate == 0)
+    return false;
+
+  for(uint8_t i = 0; i < sizeof(segments) / sizeof(segments[0]); ++i)
+  {
+    uint32_t divider = 2 * segments[i].quanta * bitRate;
+    if(OscillatorFrequency % divider != 0 || OscillatorFrequency / divider == 0 || OscillatorFrequency / divider > 64)
+      continue;
+
+    uint8_t prescaler = OscillatorFrequency / divider - 1;
+    bool tripleSampling = bitRate <= BitRate125k;
+    cnf[0] = 0x80 | (segments[i].phase2 - 1); // CNF3: SOF, PHSEG2
+    cnf[1] = 0x80 | (tripleSampling? 0x40 : 0x00) | ((segments[i].phase1 - 1) << 3) |
+             (segments[i].propagation - 1); // CNF2: BTLMODE, SAM, PHSEG1, PRSEG
+    cnf[2] = prescaler; // CNF1: SJW = 1, BRP
+    return true;
+  }
+  return false;
+}
+
+// leaves the controller in configuration mode
+void CANBase::resetController()
+{
+  SPI.begin();
+  pinMode(PinNCS, OUTPUT);
+  digitalWrite(PinNCS, HIGH);
+
+  byte resetCommand[] = {0xC0};
+  canCommand(resetCommand, sizeof(resetCommand));
+
+  delay(100);
+}
+
+void CANBase::configure(const uint8_t * cnf, bool listenOnly)
+{
+  byte initCommand[] = {
+        0x02, 0x00, //SPI_WRITE beginning at address 0
+        0x00, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80,
+        0x00, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, cnf[0], cnf[1], cnf[2], 0xBF, 0x00, 0x00, 0x00, 0x80,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80,
+        0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80,
+        0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+  canCommand(initCommand, sizeof(initCommand));
+
+  for(uint8_t buffer = 0; buffer < TransmitBufferCount; ++buffer)
+  {
+    s_sendBufferPriority[buffer] = 0;
+  }
+  s_listenOnly = listenOnly;
+}
+
+void CANBase::readErrorCounters(uint8_t * tec, uint8_t * rec)
+{
+  uint8_t counterCommand[] = {0x03, 0x1C, 0x00, 0x00}; // read TEC, REC
+  canCommand(counterCommand, sizeof(counterCommand));
+  *tec = counterCommand[2];
+  *rec = counterCommand[3];
+}
+
+void CANBase::sendMessage(const CANBase::MessageEvent * message, uint8_t buffer)
+{
+  uint8_t priority = message->priority();
+  if(priority != s_sendBufferPriority[buffer])
+  {
+    uint8_t ctrlCommand[] = {0x02, (uint8_t)(0x30 + 0x10 * buffer), priority}; // write TXBnCTRL.TXP
+    canCommand(ctrlCommand, sizeof(ctrlCommand));
+    s_sendBufferPriority[buffer] = priority;
+  }
+
+  uint8_t dlc = (message->isRTR())? 0x40 : message->length();
+
+  uint8_t msgCommand[] = {(uint8_t)(0x40 + 2 * buffer), // Write TXBn from TXBnSIDH
+    0x00, 0x00, 0x00, 0x00, // SIDH, SIDL, EIDH, EIDL
+    dlc,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+  encodeIdentifier(message->hasExtIdentifier(), message->extIdentifier(), msgCommand + 1);
+
+  if(!message->isRTR())
+  {
+    for(uint8_t i = 0; i < 8; ++i)
+    {
+      msgCommand[i + 6] = message->content[i];
+    }
+  }
+  canCommand(msgCommand, sizeof(msgCommand));
+
+  uint8_t rtsCommand[] = {(uint8_t)(0x80 | (0x01 << buffer))}; // set TXBnCTRL.TXREQ
+  canCommand(rtsCommand, sizeof(rtsCommand));
+}
+
+void CANBase::receiveMessage(CANBase::MessageEvent * message, uint8_t buffer)
+{
+  message->timestamp = millis();
+
+  uint8_t readCommand[] = { (uint8_t)(buffer? 0x94 : 0x90), // Read RXBn from RXBnSIDH
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+  canCommand(readCommand, sizeof(readCommand));
+
+  if(readCommand[2] & 0x08) // RXBnSIDL.IDE set -> extended identifier
+  {
+    message->setExtIdentifier((((ExtIdentifier) readCommand[1]) << 21) |
+                              (((ExtIdentifier) readCommand[2] & 0xE0) << 13) |
+                              (((ExtIdentifier) readCommand[2] & 0x03) << 16) |
+                              (((ExtIdentifier) readCommand[3]) << 8) |
+                               ((ExtIdentifier) readCommand[4]),
+                              readCommand[5] & 0x40); // RTR bit in RXBnDLC
+  }
+  else // standard identifier
+  {
+    message->setStdIdentifier((((StdIdentifier) readCommand[1]) << 3) |
+                              (((StdIdentifier) readCommand[2] & 0xE0) >> 5),
+                              readCommand[2] & 0x10); // RTR bit in RXBnSIDL
+  }
+
+  message->control = readCommand[5] & 0x0F; // requested length for RTR frames
+  if(!message->isRTR())
+  {
+    for(uint8_t i = 0; i < 8; ++i)
+    {
+      message->content[i] = readCommand[i + 6];
+    }
+  }
+}
+
+// SIDH, SIDL, EIDH, EIDL as used by filters and TX buffers
+void CANBase::encodeIdentifier(bool hasExtIdentifier, CANBase::ExtIdentifier identifier, uint8_t * registers)
+{
+  if(hasExtIdentifier)
+  {
+    registers[0] = (uint8_t)((identifier & 0x1FE00000) >> 21);
+    registers[1] = (uint8_t)((identifier & 0x001C0000) >> 13) |
+                   (uint8_t)((identifier & 0x00030000) >> 16) | 0x08; // EXIDE (bit 3) set
+    registers[2] = (uint8_t)((identifier & 0x0000FF00) >> 8);
+    registers[3] = (uint8_t) (identifier & 0x000000FF);
+  }
+  else
+  {
+    registers[0] = (uint8_t)((identifier & 0x7F8) >> 3);
+    registers[1] = (uint8_t)((identifier & 0x007) << 5); // EXIDE (bit 3) cleared
+    registers[2] = 0x00;
+    registers[3] = 0x00;
+  }
+}
+
+void CANBase::setMode(uint8_t mode)
+{
+  mode = (mode & 0x07) << 5;
+
+  uint8_t command[] = {0x02, 0x0F, mode}; // write requested mode field in CANCTRL
+  canCommand(command, sizeof(command));
+
+  do
+  {
+    command[0] = 0x03;
+    command[1] = 0x0E; // read current mode field in CANSTAT
+    canCommand(command, sizeof(command));
+  }
+  while((command[2] & 0xE0) != mode); // wait for mode change
+}
+
+// RX0IF, RX1IF, TXB0.TXREQ, TX0IF, TXB1.TXREQ, TX1IF, TXB2.TXREQ, TX2IF
+uint8_t CANBase::readStatus()
+{
+  uint8_t command[] = {0xA0, 0x00}; // READ STATUS
+  canCommand(command, sizeof(command));
+  return command[1];
+}
+
+void CANBase::bitModify(uint8_t address, uint8_t mask, uint8_t data)
+{
+  uint8_t command[] = {0x05, address, mask, data}; // BIT MODIFY
+  canCommand(command, sizeof(command));
+}
+
+void CANBase::canCommand(uint8_t * command, uint8_t length)
+{
+  uint8_t SaveSREG = SREG;
+  cli();
+  uint32_t start = s_measureSpi? micros() : 0;
+  SPI.beginTransaction(SPIConfig);
+  digitalWrite(PinNCS, LOW);
+  for(int i = 0; i < length; ++i) {
+    command[i] = SPI.transfer(command[i]);
+  }
+  digitalWrite(PinNCS, HIGH);
+  SPI.endTransaction();
+  if(s_measureSpi)
+  {
+    s_spiTime += micros() - start;
+  }
+  SREG = SaveSREG;
+}
+
+uint8_t CANBase::s_sendBufferPriority[CANBase::TransmitBufferCount];
+
+bool CANBase::s_listenOnly = false;
+
+bool CANBase::s_measureSpi = false;
+uint32_t CANBase::s_spiTime;
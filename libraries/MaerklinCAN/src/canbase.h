@@ -0,0 +1,193 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <SPI.h>
+
+
+// MCP2515 access shared by all queue configurations of CANBus (see can.h):
+// message layout, bit timing, acceptance filters and the SPI instructions
+class CANBase
+{
+protected:
+  static const SPISettings SPIConfig;
+
+  static constexpr int PinNCS = 10;
+  static constexpr int PinNInt = 2;
+  static constexpr int PinMISO = 12;
+  static constexpr int PinMOSI = 11;
+  static constexpr int PinSCK = 13;
+
+  static constexpr uint8_t ModeNormal = 0;
+  static constexpr uint8_t ModeSleep = 1;
+  static constexpr uint8_t ModeLoopback = 2;
+  static constexpr uint8_t ModeListen = 3;
+  static constexpr uint8_t ModeConfig = 4;
+
+public:
+  using StdIdentifier = uint16_t;
+  using ExtIdentifier = uint32_t;
+
+  // flags stored in the upper bits of MessageEvent::identifier
+  static constexpr ExtIdentifier IdentifierExtended = 0x80000000;
+  static constexpr ExtIdentifier IdentifierRemote = 0x40000000;
+  static constexpr ExtIdentifier IdentifierMask = 0x1FFFFFFF;
+
+  using ErrorEvent = struct
+  {
+    uint32_t timestamp;
+
+    uint8_t flags;
+  };
+  using ErrorHandler = void(const ErrorEvent *);
+
+  // 17 bytes: identifier type and RTR are part of the identifier, the transmit priority shares a byte with the length
+  using MessageEvent = struct
+  {
+    uint32_t timestamp;
+
+    ExtIdentifier identifier; // bit 31: extended identifier, bit 30: RTR, bit 0 - 28: identifier
+    uint8_t control; // bit 0 - 3: length, bit 4 - 5: transmit priority (TXP) 0 (lowest) - 3, ignored on reception
+    uint8_t content[8];
+
+    bool hasExtIdentifier() const { return identifier & IdentifierExtended; }
+    bool isRTR() const { return identifier & IdentifierRemote; }
+    StdIdentifier stdIdentifier() const { return identifier & 0x7FF; }
+    ExtIdentifier extIdentifier() const { return identifier & IdentifierMask; }
+    uint8_t length() const { return control & 0x0F; }
+    uint8_t priority() const { return (control >> 4) & 0x03; }
+
+    void setStdIdentifier(StdIdentifier id, bool rtr = false)
+    {
+      identifier = (id & 0x7FF) | (rtr? IdentifierRemote : 0);
+    }
+    void setExtIdentifier(ExtIdentifier id, bool rtr = false)
+    {
+      identifier = (id & IdentifierMask) | IdentifierExtended | (rtr? IdentifierRemote : 0);
+    }
+    void setLength(uint8_t length) { control = (control & 0xF0) | (length & 0x0F); }
+    void setPriority(uint8_t priority) { control = (control & 0x0F) | ((priority & 0x03) << 4); }
+  };
+  using MessageHandler = void(const MessageEvent *);
+
+  // Acceptance filter: a frame is received if (frame identifier & mask) == (identifier & mask)
+  // and its identifier type matches. The MCP2515 provides 6 filters but only 2 masks,
+  // see setReceiveFilters().
+  using ReceiveFilter = struct
+  {
+    bool hasExtIdentifier;
+    ExtIdentifier identifier; // standard identifiers use the lower 11 bits
+    ExtIdentifier mask;
+  };
+
+  static constexpr uint8_t ReceiveFilterCount = 6;
+  static constexpr uint8_t TransmitBufferCount = 3; // TXB0 - TXB2 are kept filled from the send queue
+
+  // Bit timing is derived from the crystal of the MCP2515 board. BitRate100k results in the same
+  // register values that were used before the bit rate became selectable.
+  static constexpr uint32_t OscillatorFrequency = 16000000;
+  static constexpr uint32_t BitRate100k = 100000;
+  static constexpr uint32_t BitRate125k = 125000;
+  static constexpr uint32_t BitRate250k = 250000;
+  static constexpr uint32_t BitRate500k = 500000;
+  static constexpr uint32_t BitRate1M = 1000000;
+
+  using DispatchStats = struct
+  {
+    uint16_t count; // dispatched messages
+    uint32_t maxLatency; // us from reception to dispatch
+    uint32_t totalLatency; // us
+  };
+
+  // Lost messages, queue usage and bus errors; counters stop at their maximum value.
+  using Stats = struct
+  {
+    uint16_t receiveDrops; // receive queue full
+    uint16_t sendDrops; // send queue full, reserveMessage() returned nullptr or overwrote a message
+    uint16_t errorDrops; // error queue full
+    uint8_t receiveHighWater; // most entries queued at once
+    uint8_t sendHighWater;
+    uint8_t errorHighWater;
+    uint8_t transmitErrors; // TEC of the controller
+    uint8_t receiveErrors; // REC of the controller
+    uint16_t receiveOverruns[2]; // RX0OVR, RX1OVR: frames lost because RXBn was still full
+    uint16_t messageErrors; // MERRF: errors while sending or receiving (error frames on the bus in listen-only mode)
+    uint16_t receiveRate; // frames per second, averaged over at least one second
+    uint16_t sendRate;
+  };
+
+  // Stats as sent over the bus: StatsFrameCount frames with consecutive identifiers, see encodeStats()
+  static constexpr uint8_t StatsFrameCount = 3;
+
+  // Loopback self-test, see CANBus::benchmark()
+  using BenchmarkResult = struct
+  {
+    uint16_t frames; // frames that came back intact in each phase
+    uint16_t errors; // frames lost or corrupted
+    uint16_t framesPerSecond;
+    uint16_t minLatency; // us from reserveMessage() to tryReceive() of a single frame
+    uint16_t avgLatency;
+    uint16_t maxLatency;
+    uint16_t spiTime; // us of SPI transfers (send and receive path) per frame
+  };
+  static constexpr ExtIdentifier BenchmarkIdentifier = 0x15555555; // alternating bits, maximum bit stuffing
+
+public:
+  static void setReceiveFilter(StdIdentifier identifier, StdIdentifier mask);
+  static void setReceiveFilter(ExtIdentifier identifier, ExtIdentifier mask);
+  // Up to 6 filters using at most 2 distinct masks: one mask (RXB0) may be used by at most 2 filters,
+  // the other (RXB1) by at most 4. A single mask may be shared by all 6 filters.
+  // Returns false (and leaves the filters untouched) if the list cannot be mapped onto RXF0 - RXF5.
+  static bool setReceiveFilters(const ReceiveFilter * filters, uint8_t count);
+  static void clearReceiveFilter(); // stop message reception entirely
+
+  // In listen-only mode the controller neither acknowledges frames nor sends error frames or messages,
+  // so the node is invisible on the bus. start() selects the initial mode.
+  static void setListenOnly(bool listenOnly);
+
+  // Listens to the bus at every preset bit rate in turn (without acknowledging frames) until a frame is received
+  // without errors. Waits up to timeout ms per bit rate and returns 0 if nothing was received.
+  // Must be called before start().
+  static uint32_t detectBitRate(uint16_t timeout);
+
+  static uint8_t encodeStats(const Stats * stats, uint8_t frameNo, uint8_t * content); // returns the frame length
+  static void decodeStats(uint8_t frameNo, const uint8_t * content, Stats * stats);
+
+protected:
+  CANBase() = default;
+
+  static bool bitTiming(uint32_t bitRate, uint8_t * cnf); // CNF3, CNF2, CNF1
+  static void resetController();
+  // all registers, stays in configuration mode until filters are set and then enters the listen-only or normal mode
+  static void configure(const uint8_t * cnf, bool listenOnly);
+  static void readErrorCounters(uint8_t * tec, uint8_t * rec);
+
+  static void sendMessage(const MessageEvent * message, uint8_t buffer);
+  static void receiveMessage(MessageEvent * message, uint8_t buffer);
+
+  static void encodeIdentifier(bool hasExtIdentifier, ExtIdentifier identifier, uint8_t * registers);
+
+  static void setMode(uint8_t mode);
+  static uint8_t operatingMode()
+  {
+    return s_listenOnly? ModeListen : ModeNormal;
+  }
+  static uint8_t readStatus();
+  static void bitModify(uint8_t address, uint8_t mask, uint8_t data);
+  static void canCommand(uint8_t * command, uint8_t length);
+
+  static void countEvent(uint16_t & counter)
+  {
+    if(counter != UINT16_MAX)
+    {
+      ++counter;
+    }
+  }
+
+  static uint8_t s_sendBufferPriority[TransmitBufferCount]; // TXP last written to TXBnCTRL
+
+  static bool s_listenOnly;
+
+  static bool s_measureSpi;
+  static uint32_t s_spiTime; // us spent in canCommand() while s_measureSpi is set
+};
@@ -1,6 +1,7 @@
-#include "can.h"
 #include "motorola.h"
+#include "switcharray.h"
 
+#include <can.h>
 #include <Streaming.h>
 
 /*
@@ -28,13 +29,16 @@ Then, handleSwitchArrayEvent is called with this information.
   The previous segment is marked as clear.
   The switch array is marked as idle but in need of a reset (to a neutral position).
 
-The method operateSwitchArrays is called in a busy loop as long as there are no CAN messages incoming.
-* If a switch array is idle and needs to be reset, it is reset to a neutral position (passthrough).
+CAN messages are received in polling mode: the interrupt only queues them, msgHandler is called by CAN::poll() from loop().
+The method operateSwitchArrays is called in the same loop.
+* If a switch array is idle and needs to be reset, a reset to a neutral position (passthrough) is queued.
 * If a switch array is idle and there is a train waiting in its queue and a connected track segment is free,
-  the switch array is marked busy and is set to the appropriate configuration.
-  The train waiting first in queue is then started to cross the switch array.
+  the switch array is marked busy and the appropriate configuration is queued.
+  The train waiting first in queue is started to cross the switch array as soon as the switches are set.
   After the train has crossed the switch array, it will hit a detector switch and therefore trigger a new event.
 
+Switch arrays are operated asynchronously by SwitchArray::update(), so the loop never waits for switches to move.
+
 Authors: Adrian Holfter, Lukas Wenzel
 */
 
@@ -43,8 +47,16 @@ const uint8_t trainAddressMap[] = {Motorola::IdleAddress, 1, 3, 65};
 const uint8_t trainAddressCount = 4;
 const uint8_t trainIdleAddressIndex = 0;
 uint8_t trainTargetSpeedMap[] = {0, 8, 6, 8}; // default speeds of trains - can be updated at runtime
+uint8_t trainCurrentSpeedMap[] = {0, 0, 0, 0};
+bool trainForwardMap[] = {true, true, true, true}; // absolute direction (new format messages)
+constexpr uint16_t trainParkedRefreshPeriod = 500; // ms - stopped trains leave the bandwidth to moving ones
+
+bool adaptiveRefresh = false; // unchanged messages are only repeated every adaptiveKeepAlive ms
+constexpr uint16_t adaptiveKeepAlive = 1000; // ms
+constexpr uint8_t adaptiveBurst = 3; // immediate repetitions of a changed message
 
-constexpr uint8_t switchMsgSlot = 7;
+constexpr uint8_t switchMsgSlot[] = {6, 7}; // one one-shot slot per switch array
+static_assert(Motorola::MessageBufferSize > 7, "the trains and switch arrays need slots 0 - 7");
 
 constexpr uint8_t switchArrayAddress[] = {1, 3};
 constexpr uint8_t SWITCH_ARRAY_STRAIGHT = 0xF;
@@ -56,28 +68,63 @@ uint8_t switchArrayOccupants[2][2] = {0}; // 2 switchArrays, max. 2 trains waiti
 
 volatile bool switchArrayResetNeeded[2] = {false}; // SA is free but needs to be reset
 volatile bool switchArrayBusy[2] = {false}; // train is currently passing
+uint8_t switchArrayDepartingTrain[2] = {0}; // train to start as soon as the switch array is set
+
+using CAN = CANBus<8, 4, 4>; // contact events are handled from loop(), only stats and debounce requests are sent
+constexpr uint32_t canBitRate = CAN::BitRate100k; // all sensorboards have to use the same rate
+constexpr CAN::StdIdentifier canStatsAddress = 0x400; // sensorboards answer a stats request at 0x4X0 (X: board address)
+constexpr CAN::StdIdentifier canPassageAddress = 0x500; // sensorboards with contact pairs send train passages at 0x5XN
+// sensorboard debounce times: a request at 0x4X8 is answered in 0x4X8 - 0x4XB (4 contacts each), set at 0x4XC
+constexpr uint8_t canDebounceFrame = 0x8;
+constexpr uint8_t canDebounceFrameCount = 4;
+constexpr uint8_t canDebounceSetFrame = 0xC;
+CAN::Stats sensorboardStats;
+constexpr uint16_t canSelfTestFrames = 16; // on startup
+constexpr uint16_t canBenchmarkFrames = 500; // command T
 
 // Serial parsing foo
 int incomingSerialByte;
 int serialBytes[3] = {0};
 int parsedSerialBytes[3] = {-1};
+// K command: board, contact (or *), debounceIn and debounceOut (2 digits each), or board and ?
+int debounceCommand[6];
+uint8_t debounceCommandLength = UINT8_MAX; // UINT8_MAX: no K command being typed
+
+// a batch sets and enables the slot of every train at most once
+static_assert(2 * trainAddressCount <= Motorola::Batch::Size, "Motorola::Batch too small for all trains");
 
-void setSwitchArray(uint8_t decoderAddress, uint8_t states) //first 4 bits: 0 = straight, 1 = diverging
+Motorola::Message trainSpeedMessage(uint8_t trainNo, uint8_t speed)
 {
-  unsigned long ts;
-  Motorola::setMessageSpeed(switchMsgSlot, true);
-  Motorola::setMessageOneShot(switchMsgSlot, true);
-  for(int i = 0; i < 4; ++i)
-  {
-    ts = millis();
-    Motorola::setMessage(switchMsgSlot, Motorola::switchMessage(decoderAddress, 2 * i + ((states & (0x1 << i))? 1 : 0), true));
-    Motorola::enableMessage(switchMsgSlot);
-    while((millis()-ts) < 150 || Motorola::messageEnabled(switchMsgSlot));
-    ts = millis();
-    Motorola::setMessage(switchMsgSlot, Motorola::switchMessage(decoderAddress, 2 * i + ((states & (0x1 << i))? 1 : 0), false));
-    Motorola::enableMessage(switchMsgSlot);
-    while((millis()-ts) < 50 || Motorola::messageEnabled(switchMsgSlot));
-  }
+  Motorola::setMessageRefreshPeriod(trainNo, speed? Motorola::RefreshContinuous : trainParkedRefreshPeriod);
+  trainCurrentSpeedMap[trainNo] = speed;
+  return Motorola::newTrainMessageDirection(trainAddressMap[trainNo], true, speed, trainForwardMap[trainNo]);
+}
+
+void setTrainSpeed(Motorola::Batch & batch, uint8_t trainNo, uint8_t speed, Motorola::Priority priority)
+{
+  batch.setMessage(trainNo, trainSpeedMessage(trainNo, speed), priority);
+}
+
+void setTrainSpeed(uint8_t trainNo, uint8_t speed, Motorola::Priority priority)
+{
+  Motorola::setMessage(trainNo, trainSpeedMessage(trainNo, speed), priority);
+}
+
+void startTrain(uint8_t trainNo)
+{
+  setTrainSpeed(trainNo, trainTargetSpeedMap[trainNo], Motorola::PriorityCommand);
+}
+
+void onSwitchArraySet(uint8_t switchArrayNo)
+{
+  uint8_t trainNo = switchArrayDepartingTrain[switchArrayNo];
+  switchArrayDepartingTrain[switchArrayNo] = 0;
+  if(trainNo == 0)
+    return;
+
+  startTrain(trainNo);
+
+  Serial << F("SA") << switchArrayNo << F(" is set, starting train ") << trainNo << endl;
 }
 
 uint32_t decodeLong(const uint8_t * encoded)
@@ -91,9 +138,18 @@ uint32_t decodeLong(const uint8_t * encoded)
 void stopAllTrains()
 {
   Serial << F("stopping all trains") << endl;
+  switchArrayDepartingTrain[0] = 0; // don't start waiting trains once their switch array is set
+  switchArrayDepartingTrain[1] = 0;
+
+  // all trains are stopped at the same packet boundary
+  Motorola::Batch batch;
   for(uint8_t trainNo = 0; trainNo < trainAddressCount; trainNo++)
   {
-    Motorola::setMessage(trainNo, Motorola::oldTrainMessage(trainAddressMap[(uint8_t)trainNo], true, (uint8_t)0));
+    setTrainSpeed(batch, trainNo, 0, Motorola::PriorityEmergency);
+  }
+  if(!batch.commit())
+  {
+    Serial << F("### WARNING: stop batch overflow, not all trains were stopped") << endl;
   }
 }
 
@@ -134,7 +190,7 @@ void handleSwitchArrayEvent(uint8_t section, bool entering)
     }
 
     // stop train
-    Motorola::setMessage(trainNo, Motorola::oldTrainMessage(trainAddressMap[trainNo], true, 0));
+    setTrainSpeed(trainNo, 0, Motorola::PriorityEmergency);
 
     Serial << F("SA") << switchArrayNo << F(" queue: ") << switchArrayOccupants[switchArrayNo][0] << F(" ")
                                                   << switchArrayOccupants[switchArrayNo][1] << endl;
@@ -218,16 +274,94 @@ void handleSwitchArrayEvent(uint8_t section, bool entering)
   }
 }
 
-void msgHandler(const CAN::MessageEvent * message)
+void printCanStats(const CAN::Stats * stats)
 {
+  Serial << F("drops rx ") << stats->receiveDrops << F(", tx ") << stats->sendDrops << F(", error ") << stats->errorDrops
+         << F("; queue max rx ") << stats->receiveHighWater << F(", tx ") << stats->sendHighWater << F(", error ")
+         << stats->errorHighWater << endl;
+  Serial << F("TEC ") << stats->transmitErrors << F(", REC ") << stats->receiveErrors << F("; overruns RXB0 ")
+         << stats->receiveOverruns[0] << F(", RXB1 ") << stats->receiveOverruns[1] << F("; message errors ")
+         << stats->messageErrors << F("; ") << stats->receiveRate
+         << F(" rx/s, ") << stats->sendRate << F(" tx/s") << endl;
+}
 
-  CAN::StdIdentifier contactAddr = message->stdIdentifier;
-  uint32_t duration = decodeLong(message->content + 4);
+void runCanBenchmark(uint16_t frameCount)
+{
+  CAN::BenchmarkResult result;
+  bool passed = CAN::benchmark(frameCount, &result);
+  Serial << F("CAN loopback ") << (passed? F("passed") : F("FAILED")) << F(": ") << result.frames << F(" frames, ")
+         << result.errors << F(" errors, ") << result.framesPerSecond << F(" frames/s, latency ") << result.minLatency
+         << F(" / ") << result.avgLatency << F(" / ") << result.maxLatency << F(" us, SPI ") << result.spiTime
+         << F(" us/frame") << endl;
+}
 
-  if((contactAddr & 0x1) != 0)
+void requestSensorboardStats(uint8_t board)
+{
+  CAN::MessageEvent * msg = CAN::reserveMessage();
+  if(!msg)
+    return;
+  msg->setStdIdentifier(canStatsAddress | (board << 4), true);
+  CAN::commitMessage(msg);
+}
+
+void requestSensorboardDebounce(uint8_t board)
+{
+  CAN::MessageEvent * msg = CAN::reserveMessage();
+  if(!msg)
     return;
+  msg->setStdIdentifier(canStatsAddress | (board << 4) | canDebounceFrame, true);
+  CAN::commitMessage(msg);
+}
 
-  if(duration != 0)
+// contactNumber 0xFF: all contacts; the board answers with its debounce times
+void setSensorboardDebounce(uint8_t board, uint8_t contactNumber, uint8_t samplesIn, uint8_t samplesOut)
+{
+  CAN::MessageEvent * msg = CAN::reserveMessage();
+  if(!msg)
+    return;
+  msg->setStdIdentifier(canStatsAddress | (board << 4) | canDebounceSetFrame);
+  msg->setLength(3);
+  msg->content[0] = contactNumber;
+  msg->content[1] = samplesIn;
+  msg->content[2] = samplesOut;
+  CAN::commitMessage(msg);
+}
+
+void handleDebounceMessage(const CAN::MessageEvent * message)
+{
+  uint8_t firstContact = 4 * ((message->stdIdentifier() & 0x00F) - canDebounceFrame);
+  Serial << F("Sensorboard ") << ((message->stdIdentifier() >> 4) & 0x00F) << F(" debounce in/out ") << firstContact
+         << F("-") << (firstContact + 3) << F(":");
+  for(uint8_t i = 0; i < 4 && 2 * i + 1 < message->length(); ++i)
+  {
+    Serial << F(" ") << message->content[2 * i] << F("/") << message->content[2 * i + 1];
+  }
+  Serial << endl;
+}
+
+void handleStatsMessage(const CAN::MessageEvent * message)
+{
+  uint8_t frameNo = message->stdIdentifier() & 0x00F;
+  if(!message->isRTR() && frameNo >= canDebounceFrame && frameNo < canDebounceFrame + canDebounceFrameCount)
+  {
+    handleDebounceMessage(message);
+    return;
+  }
+  if(message->isRTR() || frameNo >= CAN::StatsFrameCount)
+    return;
+
+  CAN::decodeStats(frameNo, message->content, &sensorboardStats);
+  if(frameNo == CAN::StatsFrameCount - 1)
+  {
+    Serial << F("Sensorboard ") << ((message->stdIdentifier() >> 4) & 0x00F) << F(" CAN:") << endl;
+    printCanStats(&sensorboardStats);
+  }
+}
+
+// contactAddr: low nibble of a contact event (or of a passage, where even means the same direction)
+void handleContactEvent(CAN::StdIdentifier contactAddr)
+{
+  if((contactAddr & 0x1) != 0)
     return;
 
   uint8_t section = UINT8_MAX;
@@ -274,18 +408,52 @@ void msgHandler(const CAN::MessageEvent * message)
   handleSwitchArrayEvent(section, entering);
 }
 
+// one frame per train passing a contact pair: first closing (ms), speed (mm/s), length (mm)
+void handlePassageMessage(const CAN::MessageEvent * message)
+{
+  uint16_t speed = message->content[4] | (message->content[5] << 8);
+  uint16_t length = message->content[6] | (message->content[7] << 8);
+  Serial << F("Passage ") << _HEX(message->stdIdentifier()) << F(": ") << speed << F(" mm/s, ") << length << F(" mm")
+         << endl;
+
+  handleContactEvent(message->stdIdentifier());
+}
+
+void msgHandler(const CAN::MessageEvent * message)
+{
+  if((message->stdIdentifier() & 0x700) == canStatsAddress)
+  {
+    handleStatsMessage(message);
+    return;
+  }
+
+  if((message->stdIdentifier() & 0x700) == canPassageAddress)
+  {
+    handlePassageMessage(message);
+    return;
+  }
+
+  uint32_t duration = decodeLong(message->content + 4);
+  if(duration != 0)
+    return;
+
+  handleContactEvent(message->stdIdentifier());
+}
+
 void operateSwitchArrays()
 {
     for(uint8_t switchArrayNo = 0; switchArrayNo < 2; switchArrayNo++)
     {
       if(switchArrayResetNeeded[switchArrayNo])
       {
-        setSwitchArray(switchArrayAddress[switchArrayNo], SWITCH_ARRAY_STRAIGHT);
-        switchArrayResetNeeded[switchArrayNo] = false;
+        if(SwitchArray::set(switchArrayNo, SWITCH_ARRAY_STRAIGHT))
+        {
+          switchArrayResetNeeded[switchArrayNo] = false;
+        }
         continue;
       }
 
-      if(switchArrayBusy[switchArrayNo])
+      if(switchArrayBusy[switchArrayNo] || !SwitchArray::idle(switchArrayNo))
         continue;
 
       uint8_t nextTrainNo = switchArrayOccupants[switchArrayNo][0];
@@ -334,37 +502,139 @@ void operateSwitchArrays()
 
         Serial << F("SA") << switchArrayNo << F(" is busy") << endl;
 
+        Serial << F("Starting train ") << nextTrainNo << F(" from section ") << currentSection << F(" to ") << freeSection << endl;
+
         // operate switch array, if neccessary
         if((currentSection & 0x1) != (freeSection & 0x1))
         {
-          // train needs to switch tracks
+          // train needs to switch tracks and is started by onSwitchArraySet()
+          switchArrayDepartingTrain[switchArrayNo] = nextTrainNo;
           if(currentSection & 0x1)
           {
             // switch in->out
-            setSwitchArray(switchArrayAddress[switchArrayNo], SWITCH_ARRAY_IN2OUT);
+            SwitchArray::set(switchArrayNo, SWITCH_ARRAY_IN2OUT, &onSwitchArraySet);
           }
           else
           {
             // switch out->in
-            setSwitchArray(switchArrayAddress[switchArrayNo], SWITCH_ARRAY_OUT2IN);
+            SwitchArray::set(switchArrayNo, SWITCH_ARRAY_OUT2IN, &onSwitchArraySet);
           }
+        }
+        else
+        {
           // note that no action has to be taken for in->in or out->out
           // since the switch array is always reset to this state
+          startTrain(nextTrainNo);
         }
-
-        // start train
-        Motorola::setMessage(nextTrainNo, Motorola::oldTrainMessage(trainAddressMap[(uint8_t)nextTrainNo], true, (uint8_t)trainTargetSpeedMap[nextTrainNo]));
-
-        Serial << F("Starting train ") << nextTrainNo << F(" from section ") << currentSection << F(" to ") << freeSection << endl;
       }
     }
 }
 
+void faultHandler(const Motorola::FaultStats * fault)
+{
+  switch(fault->state)
+  {
+    case Motorola::FaultBackOff:
+      Serial << F("### ERROR: Booster fault ") << fault->consecutiveFaults << F(" in a row (") << fault->totalFaults
+             << F(" total), rail power is off - retrying") << endl;
+      break;
+    case Motorola::FaultLatched:
+      Serial << F("### ERROR: Booster fault ") << fault->consecutiveFaults << F(" in a row (") << fault->totalFaults
+             << F(" total), rail power stays off - send R to retry") << endl;
+      break;
+    case Motorola::FaultNone:
+      Serial << F("Rail power restored after ") << fault->lastRecoveryTime << F(" ms (") << fault->totalFaults
+             << F(" faults total)") << endl;
+      break;
+  }
+}
+
 void errorHandler(const CAN::ErrorEvent * error)
 {
   Serial << F("ERROR: 0x") << _HEX(error->flags) << endl;
 }
 
+void printMotorolaStats()
+{
+  static const char * const priorityNames[] = {"emergency", "command", "refresh"};
+  for(uint8_t p = 0; p < Motorola::PriorityCount; ++p)
+  {
+    Motorola::QueueStats stats;
+    Motorola::getQueueStats((Motorola::Priority)p, &stats);
+    Serial << priorityNames[p] << F(": ") << stats.count << F(" msgs, avg ")
+           << (stats.count? stats.totalDelay / stats.count : 0) << F(" us, max ") << stats.maxDelay << F(" us, ")
+           << Motorola::getClassPacketCount((Motorola::Priority)p) << F(" packets") << endl;
+  }
+  Serial << F("idle: ") << Motorola::getIdlePacketCount() << F(" packets") << endl;
+
+  CAN::DispatchStats dispatchStats;
+  CAN::getDispatchStats(&dispatchStats);
+  Serial << F("CAN: ") << dispatchStats.count << F(" msgs, latency avg ")
+         << (dispatchStats.count? dispatchStats.totalLatency / dispatchStats.count : 0) << F(" us, max ")
+         << dispatchStats.maxLatency << F(" us") << endl;
+
+  CAN::Stats canStats;
+  CAN::getStats(&canStats);
+  printCanStats(&canStats);
+  for(uint8_t n = 0; n < Motorola::MessageBufferSize; ++n)
+  {
+    if(Motorola::messageEnabled(n))
+    {
+      Serial << F("slot ") << n << F(": refresh every ") << Motorola::getRefreshInterval(n) << F(" ms, ")
+             << Motorola::getSlotPacketCount(n) << F(" packets") << endl;
+    }
+  }
+}
+
+int parseHexDigit(int character)
+{
+  if(character >= '0' && character <= '9')
+    return character - '0';
+  if(character >= 'A' && character <= 'F')
+    return character - 'A' + 10;
+  return -1;
+}
+
+// collects the characters of a K command, which is longer than the other commands
+void parseDebounceCommand(int character)
+{
+  bool valid = (parseHexDigit(character) != -1) || (debounceCommandLength == 1 && (character == '?' || character == '*'));
+  if(!valid)
+  {
+    Serial << F("### WARNING: K[board]? or K[board][contact or *][in][out], hex digits") << endl;
+    debounceCommandLength = UINT8_MAX;
+    return;
+  }
+  debounceCommand[debounceCommandLength++] = character;
+
+  uint8_t board = parseHexDigit(debounceCommand[0]);
+  if(debounceCommandLength == 2 && character == '?')
+  {
+    Serial << F("Sensorboard ") << board << F(": requesting debounce times") << endl;
+    requestSensorboardDebounce(board);
+    debounceCommandLength = UINT8_MAX;
+    return;
+  }
+  if(debounceCommandLength < 6)
+    return;
+
+  debounceCommandLength = UINT8_MAX;
+  uint8_t contactNumber = (debounceCommand[1] == '*')? 0xFF : parseHexDigit(debounceCommand[1]);
+  uint8_t samplesIn = parseHexDigit(debounceCommand[2]) << 4 | parseHexDigit(debounceCommand[3]);
+  uint8_t samplesOut = parseHexDigit(debounceCommand[4]) << 4 | parseHexDigit(debounceCommand[5]);
+  Serial << F("Sensorboard ") << board << F(" contact ");
+  if(contactNumber == 0xFF)
+  {
+    Serial << F("*");
+  }
+  else
+  {
+    Serial << contactNumber;
+  }
+  Serial << F(": debounce in/out ") << samplesIn << F("/") << samplesOut << F(" samples") << endl;
+  setSensorboardDebounce(board, contactNumber, samplesIn, samplesOut);
+}
+
 void parseSerialInput()
 {
   // Read 1 serial byte
@@ -372,10 +642,41 @@ void parseSerialInput()
   if(incomingSerialByte == -1)
     return;
 
-  if(incomingSerialByte == 'H')
+  if(debounceCommandLength != UINT8_MAX)
+  {
+    parseDebounceCommand(incomingSerialByte);
+    return;
+  }
+
+  if(incomingSerialByte == 'K')
+  {
+    debounceCommandLength = 0;
+    return;
+  }
+  else if(incomingSerialByte == 'H')
   {
 	stopAllTrains();
   }
+  else if(incomingSerialByte == 'S')
+  {
+    printMotorolaStats();
+  }
+  else if(incomingSerialByte == 'T')
+  {
+    runCanBenchmark(canBenchmarkFrames);
+  }
+  else if(incomingSerialByte == 'R')
+  {
+    Serial << F("retrying rail power") << endl;
+    Motorola::clearFault();
+  }
+  else if(incomingSerialByte == 'A')
+  {
+    adaptiveRefresh = !adaptiveRefresh;
+    Motorola::setAdaptiveRefresh(adaptiveRefresh, adaptiveKeepAlive, adaptiveBurst);
+    Motorola::resetPacketCounts();
+    Serial << F("adaptive refresh ") << (adaptiveRefresh? F("on") : F("off")) << endl;
+  }
 
   // barrel shift incoming bytes
   serialBytes[0] = serialBytes[1];
@@ -385,12 +686,13 @@ void parseSerialInput()
   // check that every byte is in [0-9A-F]
   for(int i=1; i<3; i++)
   {
-    if(serialBytes[i] >= '0' && serialBytes[i] <= '9')
-      parsedSerialBytes[i] = serialBytes[i] - '0';
-    else if(serialBytes[i] >= 'A' && serialBytes[i] <= 'F')
-      parsedSerialBytes[i] = serialBytes[i] - 'A' + 10;
-    else
-      parsedSerialBytes[i] = -1;
+    parsedSerialBytes[i] = parseHexDigit(serialBytes[i]);
+  }
+
+  if(serialBytes[1] == 'Q' && parsedSerialBytes[2] != -1) // query sensorboard stats
+  {
+    requestSensorboardStats(parsedSerialBytes[2]);
+    return;
   }
 
   if(parsedSerialBytes[1] == -1 || parsedSerialBytes[2] == -1)
@@ -411,7 +713,27 @@ void parseSerialInput()
        0 <= speed && speed < 16)
     {
       trainTargetSpeedMap[trainNo] = speed;
-      Motorola::setMessage(trainNo, Motorola::oldTrainMessage(trainAddressMap[(uint8_t)trainNo], true, (uint8_t)speed));
+      setTrainSpeed(trainNo, speed, Motorola::PriorityCommand);
+    }
+  }
+  else if(serialBytes[0] == 'D' || serialBytes[0] == 'F') // direction, functions
+  {
+    long trainNo = parsedSerialBytes[1];
+    long value = parsedSerialBytes[2];
+
+    if(trainNo == trainIdleAddressIndex || trainNo >= trainAddressCount)
+      return;
+
+    if(serialBytes[0] == 'D')
+    {
+      Serial << F("Zug ") << trainNo << F(" Richtung: ") << (value? F("vorwaerts") : F("rueckwaerts")) << endl;
+      trainForwardMap[trainNo] = value;
+      setTrainSpeed(trainNo, trainCurrentSpeedMap[trainNo], Motorola::PriorityCommand);
+    }
+    else
+    {
+      Serial << F("Zug ") << trainNo << F(" Funktionen: ") << _HEX(value) << endl;
+      Motorola::setMessageFunctions(trainNo, value);
     }
   }
   else if(serialBytes[0] == 'W') // switch
@@ -431,41 +753,68 @@ void parseSerialInput()
             state = SWITCH_ARRAY_STRAIGHT;
     }
     Serial << F("Weiche ") << swaAddr << F(": ") << state << endl;
-    setSwitchArray(switchArrayAddress[swaAddr], state);
+    if(!SwitchArray::set(swaAddr, state))
+    {
+      Serial << F("### WARNING: Switch array ") << swaAddr << F(" is not available") << endl;
+    }
   }
 }
 
 void setup() {
   Motorola::start();
+  Motorola::setFaultHandler(&faultHandler);
+  SwitchArray::start(switchArrayAddress, switchMsgSlot);
 
-  // reset switch arrays
+  // reset switch arrays (in parallel) before any train is started
   for(uint8_t switchArrayNo = 0; switchArrayNo < 2; switchArrayNo++)
   {
-    setSwitchArray(switchArrayAddress[switchArrayNo], SWITCH_ARRAY_STRAIGHT);
+    SwitchArray::set(switchArrayNo, SWITCH_ARRAY_STRAIGHT);
+  }
+  while(!SwitchArray::idle(0) || !SwitchArray::idle(1))
+  {
+    SwitchArray::update();
+    Motorola::update();
   }
 
+  Motorola::Batch batch;
   for(uint8_t i = 0; i < trainAddressCount; ++i)
   {
     // Don't create a dedicated message slot for the idle message
     if(i == trainIdleAddressIndex)
       continue;
 
-    Motorola::setMessage(i, Motorola::oldTrainMessage(trainAddressMap[i], true, trainTargetSpeedMap[i]));
     Motorola::setMessageSpeed(i, false);
     Motorola::setMessageOneShot(i, false);
-    Motorola::enableMessage(i);
+    Motorola::setMessagePriority(i, Motorola::PriorityCommand);
+    Motorola::setMessageFunctions(i, 0);
+    setTrainSpeed(batch, i, trainTargetSpeedMap[i], Motorola::PriorityCommand);
+    batch.enableMessage(i);
   }
+  bool started = batch.commit(); // start all trains in the same refresh round
 
-  CAN::StdIdentifier address = 0x300;
-  CAN::StdIdentifier mask = 0x700;
-  CAN::start(&msgHandler, &errorHandler);
-  CAN::setReceiveFilter(address, mask);
+  const CAN::ReceiveFilter filters[] = {
+    {false, 0x300, 0x700}, // contact events
+    {false, canStatsAddress, 0x700}, // stats replies
+    {false, canPassageAddress, 0x700} // train passages
+  };
+  CAN::start(&msgHandler, &errorHandler, canBitRate);
+  CAN::setPolling(true);
+  CAN::setReceiveFilters(filters, 3);
 
   Serial.begin(9600);
   Serial.setTimeout(60000);
+  if(!started)
+  {
+    Serial << F("### WARNING: start batch overflow, not all trains were started") << endl;
+  }
+
+  runCanBenchmark(canSelfTestFrames);
 }
 
 void loop() {
+  CAN::poll();
   parseSerialInput();
   operateSwitchArrays();
+  SwitchArray::update();
+  Motorola::update();
 }
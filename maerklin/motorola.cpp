@@ -5,227 +5,432 @@ ISR(TIMER1_OVF_vect)
   Motorola::onTimerOverflow();
 }
 
-uint8_t addressToLineBits(int8_t address)
+void Motorola::start()
 {
-    // fixes for weird encoding
-    if (address == 80) address = 0;
-    if (address < 0 || address > 80) address = 81;
+  cli();
 
-    uint8_t encodedAddress = 0;
+  digitalWrite(PinGo, LOW);
+  pinMode(PinGo, OUTPUT);
 
-    uint8_t dividend = address;
-    uint8_t quotient = 0;
-    uint8_t remainder = 0;
+  digitalWrite(PinData, HIGH);
+  pinMode(PinData, OUTPUT);
 
-    uint8_t trits[] = {
-        0b00, // 0
-        0b11, // 1
-        0b01  // "open"
-    };
+  pinMode(PinError, INPUT);
+  attachInterrupt(digitalPinToInterrupt(PinError), &onErrorPin, RISING);
 
-    for(uint8_t i=0; i<4; i++)
-    {
-        quotient = dividend / 3;
-        remainder = dividend % 3;
+  s_msgEnabled.clear();
+  s_msgSpeed.clear();
+  s_msgOneShot.clear();
+  s_msgFunctionCycle.clear();
+  for(uint8_t n = 0; n < MessageBufferSize; ++n)
+  {
+    s_msgPriority[n] = PriorityRefresh;
+    s_msgRefreshPeriod[n] = RefreshContinuous;
+    s_msgLastSent[n] = 0;
+    s_msgRefreshInterval[n] = 0;
+    s_msgFunctions[n] = 0;
+    s_msgBurst[n] = 0;
+  }
+  s_adaptiveRefresh = false;
+  s_adaptiveBurst = 0;
+  resetPacketCounts();
+  for(uint8_t p = 0; p < PriorityCount; ++p)
+  {
+    s_msgPending[p].clear();
+  }
+  resetQueueStats();
+  s_currentMsgNumber = MessageBufferSize - 1;
+  loadNextMessage();
+  s_waveIndex = 0;
 
-        dividend = quotient;
+  TCCR1A = 0b11000010;
+  TCCR1B = 0b00011010; // non inverted fast PWM on OC1A (D9), fT1 = fCPU / 8, TOP = ICR1
+  ICR1 = 416;
+  OCR1A = 0;
+  TIMSK1 |= (1 << TOIE1); // Enable Timer 1 Overflow Interrupt
+  TIFR1 = 0;
+  TCNT1  = 0;
+  s_running = true;
 
-        encodedAddress |= trits[remainder] << (2*i);
-    }
+  s_faultStats.state = FaultNone;
+  s_faultStats.consecutiveFaults = 0;
+  s_faultStats.totalFaults = 0;
+  s_faultStats.lastRecoveryTime = 0;
+  s_faultChanged = false;
 
-    return encodedAddress;
+  sei();
+  digitalWrite(PinGo, LOW);
 }
 
-uint8_t speedToLineBits(uint8_t speed)
+void Motorola::setMessage(uint8_t n, Message message)
 {
-    if (speed > 15)
-    {
-        speed = 15;
-    }
-    uint8_t encodedSpeed = 0;
+  if(n < MessageBufferSize)
+  {
+    setMessage(n, message, s_msgPriority[n]);
+  }
+}
+void Motorola::setMessage(uint8_t n, Message message, Priority priority)
+{
+  uint8_t SaveSREG = SREG;
+  cli(); // clear interrupt flag
 
-    for(uint8_t i = 0; i < 4; i++)
-    {
-      encodedSpeed |= ((speed & (0x1 << i))? 0b11 : 0b00) << (2*i);
-    }
+  storeMessage(n, message, priority);
 
-    return encodedSpeed;
+  SREG = SaveSREG; // restore interrupt flag
+}
+Motorola::Message Motorola::getMessage(uint8_t n)
+{
+  if(n < MessageBufferSize)
+  {
+    return s_msgBuffer[n];
+  }
+  return IdleMessage;
+}
+void Motorola::enableMessage(uint8_t n)
+{
+  uint8_t SaveSREG = SREG;
+  cli(); // clear interrupt flag
+
+  storeEnabled(n, true);
+
+  SREG = SaveSREG; // restore interrupt flag
+}
+void Motorola::disableMessage(uint8_t n)
+{
+  uint8_t SaveSREG = SREG;
+  cli(); // clear interrupt flag
+
+  storeEnabled(n, false);
+
+  SREG = SaveSREG; // restore interrupt flag
+}
+
+boolean Motorola::messageEnabled(uint8_t n)
+{
+  return n < MessageBufferSize && s_msgEnabled.test(n);
 }
 
-uint8_t switchStateToLineBits(uint8_t switchAddress, bool state)
+void Motorola::setMessageSpeed(uint8_t n, boolean speed)
 {
-  uint8_t encodedState = 0;
+  uint8_t SaveSREG = SREG;
+  cli(); // clear interrupt flag
 
-  for(int i = 0; i < 3; ++i)
+  if(n < MessageBufferSize)
   {
-    encodedState |= ((switchAddress & (0x1 << i))? 0b11 : 0b00) << (2*i);
+    s_msgSpeed.assign(n, speed);
   }
-  encodedState |= (state? 0b11 : 0b00) << 6;
 
-  return encodedState;
+  SREG = SaveSREG; // restore interrupt flag
 }
 
-Motorola::Message Motorola::oldTrainMessage(uint8_t address, bool function, uint8_t speedLevel)
+void Motorola::setMessageOneShot(uint8_t n, boolean oneShot)
 {
-  Motorola::Message message = 0;
+  uint8_t SaveSREG = SREG;
+  cli(); // clear interrupt flag
 
-  message |= ((uint32_t) speedToLineBits(speedLevel)) << 10;
-  message |= (function? 0b11 : 0b00) << 8;
-  message |= ((uint32_t) addressToLineBits(address)) << 0;
+  if(n < MessageBufferSize)
+  {
+    s_msgOneShot.assign(n, oneShot);
+  }
 
-  return message;
+  SREG = SaveSREG; // restore interrupt flag
 }
 
-Motorola::Message Motorola::switchMessage(uint8_t decoderAddress, uint8_t switchAddress, bool state)
+void Motorola::setMessagePriority(uint8_t n, Priority priority)
 {
-  Motorola::Message message = 0;
-
-  message |= ((uint32_t) switchStateToLineBits(switchAddress, state)) << 10;
-  message |= ((uint32_t) addressToLineBits(decoderAddress)) << 0;
+  if(n < MessageBufferSize && priority < PriorityCount)
+  {
+    s_msgPriority[n] = priority;
+  }
+}
 
-  return message;
+Motorola::Priority Motorola::getMessagePriority(uint8_t n)
+{
+  if(n < MessageBufferSize)
+  {
+    return s_msgPriority[n];
+  }
+  return PriorityRefresh;
 }
 
-void Motorola::start()
+void Motorola::setMessageRefreshPeriod(uint8_t n, uint16_t period)
 {
-  cli();
+  uint8_t SaveSREG = SREG;
+  cli(); // clear interrupt flag
 
-  digitalWrite(PinGo, LOW);
-  pinMode(PinGo, OUTPUT);
+  if(n < MessageBufferSize)
+  {
+    s_msgRefreshPeriod[n] = period;
+  }
 
-  digitalWrite(PinData, HIGH);
-  pinMode(PinData, OUTPUT);
+  SREG = SaveSREG; // restore interrupt flag
+}
 
-  pinMode(PinError, INPUT);
-  attachInterrupt(digitalPinToInterrupt(PinError), &onErrorPin, RISING);
+uint16_t Motorola::getRefreshInterval(uint8_t n)
+{
+  if(n >= MessageBufferSize)
+    return 0;
 
-  s_msgEnabled = 0;
-  s_msgSpeed = 0;
-  s_msgOneShot = 0;
-  s_currentMsgNumber = 0;
-  loadNextMessage();
-  s_state = false;
-  s_bitCounter = 0;
+  uint8_t SaveSREG = SREG;
+  cli(); // clear interrupt flag
 
-  TCCR1A = 0b11000010;
-  TCCR1B = 0b00011010; // non inverted fast PWM on OC1A (D9), fT1 = fCPU / 8, TOP = ICR1
-  ICR1 = 416;
-  OCR1A = 0;
-  TIMSK1 |= (1 << TOIE1); // Enable Timer 1 Overflow Interrupt
-  TIFR1 = 0;
-  TCNT1  = 0;
-  s_running = true;
+  uint16_t interval = s_msgRefreshInterval[n];
 
-  sei();
-  digitalWrite(PinGo, LOW);
+  SREG = SaveSREG; // restore interrupt flag
+  return interval;
 }
 
-void Motorola::setMessage(uint8_t n, Message message)
+void Motorola::setMessageFunctions(uint8_t n, uint8_t functions)
 {
+  if(n >= MessageBufferSize)
+    return;
+
   uint8_t SaveSREG = SREG;
   cli(); // clear interrupt flag
 
-  if(n < MessageBufferSize)
+  uint8_t changed = (s_msgFunctions[n] ^ functions) & 0x0F;
+  uint8_t next = s_msgFunctions[n] & 0x70;
+  if(changed)
   {
-    s_msgBuffer[n] = message;
+    // send the first changed function next
+    next = 0x10;
+    while(!(changed & 0x1))
+    {
+      changed >>= 1;
+      next += 0x10;
+    }
+    s_msgBurst[n] = s_adaptiveBurst;
+    markPending(n, s_msgPriority[n]);
   }
+  s_msgFunctions[n] = next | (functions & 0x0F);
+  s_msgFunctionCycle.set(n);
 
   SREG = SaveSREG; // restore interrupt flag
 }
-Motorola::Message Motorola::getMessage(uint8_t n)
+
+void Motorola::setAdaptiveRefresh(bool enabled, uint16_t keepAlive, uint8_t burst)
 {
-  if(n < MessageBufferSize)
-  {
-    return s_msgBuffer[n];
-  }
-  return IdleMessage;
+  uint8_t SaveSREG = SREG;
+  cli(); // clear interrupt flag
+
+  s_adaptiveRefresh = enabled;
+  s_adaptiveKeepAlive = keepAlive;
+  s_adaptiveBurst = enabled? burst : 0;
+
+  SREG = SaveSREG; // restore interrupt flag
 }
-void Motorola::enableMessage(uint8_t n)
+
+uint32_t Motorola::getSlotPacketCount(uint8_t n)
 {
+  if(n >= MessageBufferSize)
+    return 0;
+
   uint8_t SaveSREG = SREG;
   cli(); // clear interrupt flag
 
-  s_msgEnabled |= (0x1 << n);
+  uint32_t count = s_msgPacketCount[n];
 
   SREG = SaveSREG; // restore interrupt flag
+  return count;
 }
-void Motorola::disableMessage(uint8_t n)
+
+uint32_t Motorola::getClassPacketCount(Priority priority)
 {
+  if(priority >= PriorityCount)
+    return 0;
+
   uint8_t SaveSREG = SREG;
   cli(); // clear interrupt flag
 
-  s_msgEnabled &= ~(0x1 << n);
+  uint32_t count = s_classPacketCount[priority];
 
   SREG = SaveSREG; // restore interrupt flag
+  return count;
 }
 
-boolean Motorola::messageEnabled(uint8_t n)
+uint32_t Motorola::getIdlePacketCount()
 {
-  return s_msgEnabled & (0x1 << n);
+  uint8_t SaveSREG = SREG;
+  cli(); // clear interrupt flag
+
+  uint32_t count = s_idlePacketCount;
+
+  SREG = SaveSREG; // restore interrupt flag
+  return count;
 }
 
-void Motorola::setMessageSpeed(uint8_t n, boolean speed)
+void Motorola::resetPacketCounts()
 {
   uint8_t SaveSREG = SREG;
   cli(); // clear interrupt flag
 
-  if(speed)
+  for(uint8_t n = 0; n < MessageBufferSize; ++n)
   {
-    s_msgSpeed |= (0x1 << n);
+    s_msgPacketCount[n] = 0;
   }
-  else
+  for(uint8_t p = 0; p < PriorityCount; ++p)
   {
-    s_msgSpeed &= ~(0x1 << n);
+    s_classPacketCount[p] = 0;
   }
+  s_idlePacketCount = 0;
 
   SREG = SaveSREG; // restore interrupt flag
 }
 
-void Motorola::setMessageOneShot(uint8_t n, boolean oneShot)
+void Motorola::getQueueStats(Priority priority, QueueStats * stats)
 {
+  if(priority >= PriorityCount)
+    return;
+
   uint8_t SaveSREG = SREG;
   cli(); // clear interrupt flag
 
-  if(oneShot)
-  {
-    s_msgOneShot |= (0x1 << n);
-  }
-  else
+  *stats = s_queueStats[priority];
+
+  SREG = SaveSREG; // restore interrupt flag
+}
+
+void Motorola::resetQueueStats()
+{
+  uint8_t SaveSREG = SREG;
+  cli(); // clear interrupt flag
+
+  for(uint8_t p = 0; p < PriorityCount; ++p)
   {
-    s_msgOneShot &= ~(0x1 << n);
+    s_queueStats[p].count = 0;
+    s_queueStats[p].maxDelay = 0;
+    s_queueStats[p].totalDelay = 0;
   }
 
   SREG = SaveSREG; // restore interrupt flag
 }
 
-uint8_t cnt = 0;
+void Motorola::Batch::setMessage(uint8_t n, Message message)
+{
+  add(n, OpSetMessage, PriorityCount, message);
+}
 
-void Motorola::onTimerOverflow()
+void Motorola::Batch::setMessage(uint8_t n, Message message, Priority priority)
 {
-  if(!s_running)
+  add(n, OpSetMessage, priority, message);
+}
+
+void Motorola::Batch::enableMessage(uint8_t n)
+{
+  add(n, OpEnable, PriorityCount, 0);
+}
+
+void Motorola::Batch::disableMessage(uint8_t n)
+{
+  add(n, OpDisable, PriorityCount, 0);
+}
+
+void Motorola::Batch::add(uint8_t n, Operation op, Priority priority, Message message)
+{
+  if(m_count >= Size)
+  {
+    m_overflow = true;
     return;
+  }
+  m_entries[m_count].n = n;
+  m_entries[m_count].op = op;
+  m_entries[m_count].priority = priority;
+  m_entries[m_count].message = message;
+  ++m_count;
+}
+
+bool Motorola::Batch::commit()
+{
+  uint8_t SaveSREG = SREG;
+  cli(); // clear interrupt flag
 
-  ICR1 = s_currentSpeed? 208 : 416;
-  if(s_bitCounter >= BitCountMsg - 1)
+  for(uint8_t i = 0; i < m_count; ++i)
   {
-    if(s_state) //End of Message repetition
+    const Entry & entry = m_entries[i];
+    switch(entry.op)
     {
-      ICR1 *= (BitCountWait + 1);
-      loadNextMessage();
+      case OpSetMessage:
+        if(entry.n < MessageBufferSize)
+        {
+          storeMessage(entry.n, entry.message, (entry.priority < PriorityCount)? entry.priority : s_msgPriority[entry.n]);
+        }
+        break;
+      case OpEnable:
+        storeEnabled(entry.n, true);
+        break;
+      case OpDisable:
+        storeEnabled(entry.n, false);
+        break;
     }
-    else // End of Message
+  }
+
+  SREG = SaveSREG; // restore interrupt flag
+
+  bool complete = !m_overflow;
+  m_count = 0;
+  m_overflow = false;
+  return complete;
+}
+
+void Motorola::storeMessage(uint8_t n, Message message, Priority priority)
+{
+  if(n < MessageBufferSize)
+  {
+    if(s_msgBuffer[n] != message)
     {
-      ICR1 *= (BitCountGap + 1);
+      s_msgBurst[n] = s_adaptiveBurst;
     }
-    s_state = !s_state;
-    s_bitCounter = 0;
+    s_msgBuffer[n] = message;
+    s_msgFunctions[n] &= 0x0F; // a new direction goes out before the next function
+    markPending(n, priority);
+  }
+}
+
+void Motorola::storeEnabled(uint8_t n, bool enabled)
+{
+  if(n >= MessageBufferSize || s_msgEnabled.test(n) == enabled)
+    return;
+
+  s_msgEnabled.assign(n, enabled);
+  if(enabled)
+  {
+    s_msgBurst[n] = s_adaptiveBurst;
+    markPending(n, s_msgPriority[n]);
+  }
+}
+
+// interrupts must be disabled
+void Motorola::markPending(uint8_t n, Priority priority)
+{
+  for(uint8_t p = 0; p < PriorityCount; ++p)
+  {
+    s_msgPending[p].reset(n);
+  }
+  if(priority >= PriorityCount)
+  {
+    priority = PriorityRefresh;
+  }
+  s_msgPending[priority].set(n);
+  s_msgPendingSince[n] = micros();
+}
+
+void Motorola::onTimerOverflow()
+{
+  if(!s_running)
+    return;
+
+  uint8_t i = s_waveIndex;
+  ICR1 = s_waveTop[i];
+  if(i == WaveformLength - 1) // End of Message repetition
+  {
+    loadNextMessage();
+    s_waveIndex = 0;
   }
   else
   {
-    ++s_bitCounter;
+    s_waveIndex = i + 1;
   }
-  boolean currentBit = (s_currentMessage >> s_bitCounter) & 0x1;
-  OCR1A = (currentBit? 182 : 26) * (s_currentSpeed? 1 : 2);
+  OCR1A = s_waveCompare[i];
 }
 
 void Motorola::onErrorPin()
@@ -234,31 +439,263 @@ void Motorola::onErrorPin()
     return;
   s_running = false;
   digitalWrite(PinGo, HIGH); //switch rail voltage off
+  registerFault();
+}
+
+void Motorola::setFaultRecovery(uint16_t backOff, uint8_t maxRetries, uint16_t stableTime)
+{
+  uint8_t SaveSREG = SREG;
+  cli(); // clear interrupt flag
+
+  s_faultBackOff = backOff;
+  s_faultMaxRetries = maxRetries;
+  s_faultStableTime = stableTime;
+
+  SREG = SaveSREG; // restore interrupt flag
+}
+
+void Motorola::setFaultHandler(FaultHandler * handler)
+{
+  s_faultHandler = handler;
+}
+
+void Motorola::getFaultStats(FaultStats * stats)
+{
+  uint8_t SaveSREG = SREG;
+  cli(); // clear interrupt flag
+
+  *stats = s_faultStats;
+
+  SREG = SaveSREG; // restore interrupt flag
+}
+
+void Motorola::clearFault()
+{
+  uint8_t SaveSREG = SREG;
+  cli(); // clear interrupt flag
+
+  if(s_faultStats.state != FaultNone)
+  {
+    s_faultStats.state = FaultBackOff;
+    s_faultStats.consecutiveFaults = 0;
+    s_faultTime = millis() - s_faultBackOff; // retry with the next update()
+  }
+
+  SREG = SaveSREG; // restore interrupt flag
+}
+
+void Motorola::update()
+{
+  uint32_t now = millis();
+
+  uint8_t SaveSREG = SREG;
+  cli(); // clear interrupt flag
+
+  if(s_faultStats.state == FaultBackOff)
+  {
+    uint8_t shift = s_faultStats.consecutiveFaults? s_faultStats.consecutiveFaults - 1 : 0;
+    uint32_t backOff = ((uint32_t) s_faultBackOff) << ((shift < 6)? shift : 6);
+    if(now - s_faultTime >= backOff)
+    {
+      if(digitalRead(PinError) == HIGH)
+      {
+        registerFault(); // booster still reports the fault
+      }
+      else
+      {
+        resume();
+      }
+    }
+  }
+  else if(s_faultStats.state == FaultNone && s_faultStats.consecutiveFaults &&
+          now - s_resumeTime >= s_faultStableTime)
+  {
+    s_faultStats.consecutiveFaults = 0;
+  }
+
+  bool changed = s_faultChanged;
+  s_faultChanged = false;
+
+  SREG = SaveSREG; // restore interrupt flag
+
+  if(changed)
+  {
+    reportFault();
+  }
+}
+
+// interrupts must be disabled
+void Motorola::registerFault()
+{
+  s_faultTime = millis();
+  if(s_faultStats.consecutiveFaults == 0)
+  {
+    s_faultSequenceStart = s_faultTime;
+  }
+  if(s_faultStats.consecutiveFaults < UINT8_MAX)
+  {
+    ++s_faultStats.consecutiveFaults;
+  }
+  ++s_faultStats.totalFaults;
+  s_faultStats.state = (s_faultStats.consecutiveFaults > s_faultMaxRetries)? FaultLatched : FaultBackOff;
+  s_faultChanged = true;
+}
+
+// interrupts must be disabled
+void Motorola::resume()
+{
+  s_resumeTime = millis();
+  s_faultStats.lastRecoveryTime = s_resumeTime - s_faultSequenceStart;
+  s_faultStats.state = FaultNone;
+  s_faultChanged = true;
+
+  // restart with a fresh packet
+  loadNextMessage();
+  s_waveIndex = 0;
+  s_running = true;
+  digitalWrite(PinGo, LOW); //switch rail voltage on
+}
+
+void Motorola::reportFault()
+{
+  if(!s_faultHandler)
+    return;
+
+  FaultStats stats;
+  getFaultStats(&stats);
+  s_faultHandler(&stats);
 }
 
 void Motorola::loadNextMessage()
 {
-  if(s_msgEnabled)
+  uint8_t n = MessageBufferSize;
+  uint16_t now = millis();
+
+  if(s_msgEnabled.any())
   {
-    MessageBufferMask mask;
-    do
+    // newly written urgent messages first
+    for(uint8_t p = 0; p < PriorityRefresh && n == MessageBufferSize; ++p)
     {
-      s_currentMsgNumber = (s_currentMsgNumber + 1) % MessageBufferSize;
-      mask = 1 << s_currentMsgNumber;
-    } while(!(s_msgEnabled & mask));
+      n = s_msgPending[p].firstCommon(s_msgEnabled);
+    }
 
-    if(s_msgOneShot & mask)
+    // refresh of all enabled messages
+    if(n == MessageBufferSize)
     {
-      s_msgEnabled &= ~mask;
+      n = nextRefreshSlot(now);
     }
-    s_currentMessage = s_msgBuffer[s_currentMsgNumber];
-    s_currentSpeed = s_msgSpeed & mask;
+  }
+
+  if(n < MessageBufferSize)
+  {
+    ++s_msgPacketCount[n];
+    ++s_classPacketCount[s_msgPriority[n]];
+    if(s_msgBurst[n])
+    {
+      --s_msgBurst[n];
+    }
+
+    for(uint8_t p = 0; p < PriorityCount; ++p)
+    {
+      if(s_msgPending[p].test(n))
+      {
+        uint32_t delay = micros() - s_msgPendingSince[n];
+        s_msgPending[p].reset(n);
+        ++s_queueStats[p].count;
+        s_queueStats[p].totalDelay += delay;
+        if(delay > s_queueStats[p].maxDelay)
+        {
+          s_queueStats[p].maxDelay = delay;
+        }
+      }
+    }
+
+    // exponential moving average (1/4) of the time between two transmissions
+    int16_t deviation = (int16_t)((uint16_t)(now - s_msgLastSent[n]) - s_msgRefreshInterval[n]);
+    s_msgRefreshInterval[n] += deviation / 4;
+    s_msgLastSent[n] = now;
+
+    if(s_msgOneShot.test(n))
+    {
+      s_msgEnabled.reset(n);
+    }
+    Message message = s_msgBuffer[n];
+    if(s_msgFunctionCycle.test(n))
+    {
+      uint8_t functionNo = (s_msgFunctions[n] >> 4) & 0x7;
+      if(functionNo)
+      {
+        Message functionMessage = withFunctionBits(message, functionNo, s_msgFunctions[n] & (0x1 << (functionNo - 1)));
+        if(functionMessageValid(functionMessage))
+        {
+          message = functionMessage;
+        }
+      }
+      functionNo = (functionNo < FunctionCount)? functionNo + 1 : 0;
+      s_msgFunctions[n] = (functionNo << 4) | (s_msgFunctions[n] & 0x0F);
+    }
+    expandMessage(message, s_msgSpeed.test(n));
   }
   else
   {
-    s_currentMessage = IdleMessage;
-    s_currentSpeed = IdleSpeed;
+    ++s_idlePacketCount;
+    expandMessage(IdleMessage, IdleSpeed);
+  }
+}
+
+// round-robin over the enabled slots, preferring slots whose refresh period has elapsed
+// if no slot is due, the next enabled slot is sent - or nothing (MessageBufferSize) in adaptive refresh mode
+// s_msgEnabled must not be empty
+uint8_t Motorola::nextRefreshSlot(uint16_t now)
+{
+  uint8_t first = s_msgEnabled.next(s_currentMsgNumber);
+  uint8_t n = first;
+  do
+  {
+    uint16_t period = s_msgRefreshPeriod[n];
+    if(s_adaptiveRefresh && period < s_adaptiveKeepAlive)
+    {
+      period = s_adaptiveKeepAlive;
+    }
+    if(s_msgBurst[n] || (uint16_t)(now - s_msgLastSent[n]) >= period)
+    {
+      s_currentMsgNumber = n;
+      return n;
+    }
+    n = s_msgEnabled.next(n);
+  } while(n != first);
+
+  if(s_adaptiveRefresh)
+    return MessageBufferSize;
+
+  s_currentMsgNumber = first;
+  return first;
+}
+
+void Motorola::expandMessage(Message message, MessageSpeed speed)
+{
+  uint16_t top = speed? TicksBit : 2 * TicksBit;
+  uint16_t pulseHigh = speed? TicksPulseHigh : 2 * TicksPulseHigh;
+  uint16_t pulseLow = speed? TicksPulseLow : 2 * TicksPulseLow;
+
+  uint16_t firstCompare = (message & 0x1)? pulseHigh : pulseLow;
+  for(uint8_t i = 0; i < BitCountMsg - 1; ++i)
+  {
+    message >>= 1;
+    uint16_t compare = (message & 0x1)? pulseHigh : pulseLow;
+    s_waveTop[i] = top;
+    s_waveTop[i + BitCountMsg] = top;
+    s_waveCompare[i] = compare;
+    s_waveCompare[i + BitCountMsg] = compare;
   }
+
+  // End of Message
+  s_waveTop[BitCountMsg - 1] = top * (BitCountGap + 1);
+  s_waveCompare[BitCountMsg - 1] = firstCompare;
+
+  // End of Message repetition
+  s_waveTop[WaveformLength - 1] = top * (BitCountWait + 1);
+  s_waveCompare[WaveformLength - 1] = firstCompare;
 }
 
 Motorola::Message Motorola::s_msgBuffer[Motorola::MessageBufferSize];
@@ -267,10 +704,41 @@ Motorola::MessageBufferMask Motorola::s_msgEnabled;
 Motorola::MessageBufferMask Motorola::s_msgSpeed;
 Motorola::MessageBufferMask Motorola::s_msgOneShot;
 
+Motorola::Priority Motorola::s_msgPriority[Motorola::MessageBufferSize];
+Motorola::MessageBufferMask Motorola::s_msgPending[Motorola::PriorityCount];
+uint32_t Motorola::s_msgPendingSince[Motorola::MessageBufferSize];
+Motorola::QueueStats Motorola::s_queueStats[Motorola::PriorityCount];
+
+uint16_t Motorola::s_msgRefreshPeriod[Motorola::MessageBufferSize];
+uint16_t Motorola::s_msgLastSent[Motorola::MessageBufferSize];
+uint16_t Motorola::s_msgRefreshInterval[Motorola::MessageBufferSize];
+
+Motorola::MessageBufferMask Motorola::s_msgFunctionCycle;
+uint8_t Motorola::s_msgFunctions[Motorola::MessageBufferSize];
+
+bool Motorola::s_adaptiveRefresh;
+uint16_t Motorola::s_adaptiveKeepAlive;
+uint8_t Motorola::s_adaptiveBurst;
+uint8_t Motorola::s_msgBurst[Motorola::MessageBufferSize];
+
+uint32_t Motorola::s_msgPacketCount[Motorola::MessageBufferSize];
+uint32_t Motorola::s_classPacketCount[Motorola::PriorityCount];
+uint32_t Motorola::s_idlePacketCount;
+
 bool Motorola::s_running = false;
 
+uint16_t Motorola::s_faultBackOff = 500;
+uint8_t Motorola::s_faultMaxRetries = 5;
+uint16_t Motorola::s_faultStableTime = 10000;
+Motorola::FaultHandler * Motorola::s_faultHandler = nullptr;
+Motorola::FaultStats Motorola::s_faultStats;
+volatile bool Motorola::s_faultChanged;
+uint32_t Motorola::s_faultTime;
+uint32_t Motorola::s_faultSequenceStart;
+uint32_t Motorola::s_resumeTime;
+
 uint8_t Motorola::s_currentMsgNumber;
-bool Motorola::s_state;
-uint8_t Motorola::s_bitCounter;
-Motorola::MessageSpeed Motorola::s_currentSpeed;
-Motorola::Message Motorola::s_currentMessage;
+
+uint16_t Motorola::s_waveTop[Motorola::WaveformLength];
+uint16_t Motorola::s_waveCompare[Motorola::WaveformLength];
+uint8_t Motorola::s_waveIndex;
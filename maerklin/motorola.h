@@ -2,14 +2,44 @@
 
 #include <Arduino.h>
 
+#include "slotmask.h"
+
+// Number of message slots, each costs about 20 bytes of RAM. motorola.cpp is compiled on its own, so a sketch needing
+// more slots than the controller (8) has to define it for every translation unit, e.g. -DMOTOROLA_SLOTS=32.
+#ifndef MOTOROLA_SLOTS
+#define MOTOROLA_SLOTS 8
+#endif
+
 class Motorola
 {
 public:
   using Message = uint32_t;
   using MessageSpeed = bool; // bit time is (speed)? 104 : 208 us
-  using MessageBufferMask = uint8_t;
 
-  static constexpr uint8_t MessageBufferSize = 8;
+  static constexpr uint8_t MessageBufferSize = MOTOROLA_SLOTS;
+  static_assert(MessageBufferSize >= 1 && MessageBufferSize < 255, "MessageBufferSize is reserved as 'no slot'");
+  using MessageBufferMask = SlotMask<MessageBufferSize>;
+
+  // Newly written messages of a slot with priority Emergency or Command are sent in the next packet window,
+  // Refresh messages (and already sent messages of all classes) share the remaining windows round-robin.
+  enum Priority : uint8_t
+  {
+    PriorityEmergency = 0,
+    PriorityCommand = 1,
+    PriorityRefresh = 2,
+    PriorityCount = 3
+  };
+
+  // delay between writing a message and sending it for the first time
+  using QueueStats = struct
+  {
+    uint16_t count;
+    uint32_t maxDelay; // us
+    uint32_t totalDelay; // us
+  };
+
+  // refresh period of slots that should be sent as often as possible
+  static constexpr uint16_t RefreshContinuous = 0;
 
   static constexpr uint8_t IdleAddress = 81;
   static constexpr Message IdleMessage = 0x00055;
@@ -23,20 +53,149 @@ public:
   static constexpr uint8_t BitCountGap = 6;
   static constexpr uint8_t BitCountWait = 22;
 
-  //TODO newTrainMessageFunction()
-  //TODO newTrainMessageDirection()
-  static Message oldTrainMessage(uint8_t address, bool function, uint8_t speedLevel);
-  static Message switchMessage(uint8_t decoderAddress, uint8_t switchAddress, bool state);
+  // Timer1 ticks (0.5 us) for fast messages, slow messages take twice as long
+  static constexpr uint16_t TicksBit = 208;
+  static constexpr uint16_t TicksPulseHigh = 182;
+  static constexpr uint16_t TicksPulseLow = 26;
+
+  // every message is played twice: 17 bits, gap (with bit 0), 17 bits, wait (with bit 0 of the next message)
+  static constexpr uint8_t WaveformLength = 2 * BitCountMsg;
+
+  static constexpr uint8_t FunctionCount = 4; // f1 - f4 of the new format
+
+  static constexpr Message oldTrainMessage(uint8_t address, bool function, uint8_t speedLevel)
+  {
+    return (((Message) speedToLineBits(speedLevel)) << 10) |
+           (((Message) (function? 0b11 : 0b00)) << 8) |
+            ((Message) addressToLineBits(address));
+  }
+
+  // New (Motorola-II) format: the second bit of every speed trit (E F G H) carries the absolute direction
+  // or the state of one of the functions f1 - f4 instead of repeating the speed bits (A B C D).
+  static constexpr Message newTrainMessageDirection(uint8_t address, bool function, uint8_t speedLevel, bool forward)
+  {
+    return withExtraBits(oldTrainMessage(address, function, speedLevel),
+                         (forward? 0b0101 : 0b0010) | ((speedLevel < 7)? 0b1000 : 0b0000));
+  }
+  // functionNo is 1 - 4; if the resulting packet is indistinguishable from an old format speed packet
+  // (see functionMessageValid()), the direction message has to be sent instead
+  static constexpr Message newTrainMessageFunction(uint8_t address, bool function, uint8_t speedLevel, uint8_t functionNo, bool state)
+  {
+    return withFunctionBits(oldTrainMessage(address, function, speedLevel), functionNo, state);
+  }
+  static constexpr bool functionMessageValid(Message message)
+  {
+    return ((message >> 10) & 0x55) != ((message >> 11) & 0x55);
+  }
+
+  static constexpr Message switchMessage(uint8_t decoderAddress, uint8_t switchAddress, bool state)
+  {
+    return (((Message) switchStateToLineBits(switchAddress, state)) << 10) |
+            ((Message) addressToLineBits(decoderAddress));
+  }
 
   static void start();
 
   static void setMessage(uint8_t n, Message message);
+  static void setMessage(uint8_t n, Message message, Priority priority); // overrides the slot priority once
   static Message getMessage(uint8_t n);
   static void enableMessage(uint8_t n);
   static void disableMessage(uint8_t n);
   static bool messageEnabled(uint8_t n);
   static void setMessageSpeed(uint8_t n, MessageSpeed speed);
   static void setMessageOneShot(uint8_t n, bool oneShot);
+  static void setMessagePriority(uint8_t n, Priority priority);
+  static Priority getMessagePriority(uint8_t n);
+
+  // Slots are only refreshed once their refresh period (ms) has elapsed since they were last sent,
+  // e.g. parked locomotives can use a long period to leave more bandwidth to moving ones.
+  // If no slot is due, the enabled slots are sent round-robin.
+  static void setMessageRefreshPeriod(uint8_t n, uint16_t period);
+  static uint16_t getRefreshInterval(uint8_t n); // achieved time between two transmissions in ms (smoothed)
+
+  // For slots holding a new format direction message: every refresh carries either the direction
+  // or one of the functions (bit 0 = f1 ... bit 3 = f4), cycling through all of them.
+  static void setMessageFunctions(uint8_t n, uint8_t functions);
+
+  // Adaptive refresh: a slot whose message did not change is refreshed at most every keepAlive ms
+  // (or its own refresh period, if longer), a changed message is repeated burst times right away.
+  // Packet windows without a due slot carry the idle message.
+  static void setAdaptiveRefresh(bool enabled, uint16_t keepAlive = 1000, uint8_t burst = 3);
+
+  static uint32_t getSlotPacketCount(uint8_t n);
+  static uint32_t getClassPacketCount(Priority priority); // by the current priority of the sending slot
+  static uint32_t getIdlePacketCount();
+  static void resetPacketCounts();
+
+  static void getQueueStats(Priority priority, QueueStats * stats);
+  static void resetQueueStats();
+
+  // Collects message updates of several slots and applies them within a single critical section,
+  // so all of them take effect at the same packet boundary (the current packet is already expanded).
+  class Batch
+  {
+  public:
+    static constexpr uint8_t Size = 8; // updates, 7 bytes each on the stack: setting and enabling 4 slots
+
+    Batch() = default;
+
+    void setMessage(uint8_t n, Message message);
+    void setMessage(uint8_t n, Message message, Priority priority);
+    void enableMessage(uint8_t n);
+    void disableMessage(uint8_t n);
+
+    bool commit(); // false if updates had to be dropped because the batch was full
+
+  private:
+    enum Operation : uint8_t
+    {
+      OpSetMessage,
+      OpEnable,
+      OpDisable
+    };
+
+    using Entry = struct
+    {
+      uint8_t n;
+      Operation op;
+      Priority priority; // PriorityCount: use slot priority
+      Message message;
+    };
+
+    void add(uint8_t n, Operation op, Priority priority, Message message);
+
+  private:
+    Entry m_entries[Size];
+    uint8_t m_count = 0;
+    bool m_overflow = false;
+  };
+
+  // Booster fault (short circuit) recovery: rail power is switched off on a rising edge of PinError
+  // and restored by update() after a back-off that doubles with every consecutive fault.
+  // After more than maxRetries consecutive faults, the rails stay off until clearFault() is called.
+  // Faults more than stableTime ms after the last recovery start a new sequence.
+  enum FaultState : uint8_t
+  {
+    FaultNone = 0,
+    FaultBackOff = 1,
+    FaultLatched = 2
+  };
+
+  using FaultStats = struct
+  {
+    FaultState state;
+    uint8_t consecutiveFaults;
+    uint16_t totalFaults;
+    uint32_t lastRecoveryTime; // ms from the first fault of a sequence until rail power was restored
+  };
+  using FaultHandler = void(const FaultStats *); // called from update() whenever the fault state changes
+
+  static void setFaultRecovery(uint16_t backOff, uint8_t maxRetries, uint16_t stableTime);
+  static void setFaultHandler(FaultHandler * handler);
+  static void getFaultStats(FaultStats * stats);
+  static void clearFault(); // retry immediately, even if latched
+
+  static void update(); // call from loop()
 
   static void onTimerOverflow();
   static void onErrorPin();
@@ -44,7 +203,58 @@ public:
 private:
   Motorola() = default;
 
+  // trinary encoding with "open" trits (fixes for weird encoding: 80 -> 0, invalid -> 81)
+  static constexpr uint8_t tritToLineBits(uint8_t trit)
+  {
+    return (trit == 0)? 0b00 : ((trit == 1)? 0b11 : 0b01);
+  }
+  static constexpr uint8_t tritsToLineBits(uint8_t value, uint8_t count)
+  {
+    return count? (tritToLineBits(value % 3) | (tritsToLineBits(value / 3, count - 1) << 2)) : 0;
+  }
+  static constexpr uint8_t addressToLineBits(int8_t address)
+  {
+    return tritsToLineBits((address == 80)? 0 : ((address < 0 || address > 80)? 81 : address), 4);
+  }
+
+  // binary encoding, every bit is sent as a pair of equal trits
+  static constexpr uint8_t bitsToLineBits(uint8_t value, uint8_t count)
+  {
+    return count? (((value & 0x1)? 0b11 : 0b00) | (bitsToLineBits(value >> 1, count - 1) << 2)) : 0;
+  }
+  static constexpr uint8_t speedToLineBits(uint8_t speed)
+  {
+    return bitsToLineBits((speed > 15)? 15 : speed, 4);
+  }
+  static constexpr uint8_t switchStateToLineBits(uint8_t switchAddress, bool state)
+  {
+    return bitsToLineBits(switchAddress, 3) | ((state? 0b11 : 0b00) << 6);
+  }
+
+  // replace the second bit of each speed trit by bit 0 (E) - 3 (H) of extra
+  static constexpr Message withExtraBits(Message message, uint8_t extra)
+  {
+    return (message & ~(((Message) 0xAA) << 10)) | (((Message) (bitsToLineBits(extra, 4) & 0xAA)) << 10);
+  }
+  // E F G = 1 1 0 (f1), 0 0 1 (f2), 0 1 1 (f3), 1 1 1 (f4), H = state
+  static constexpr Message withFunctionBits(Message message, uint8_t functionNo, bool state)
+  {
+    return withExtraBits(message, ((functionNo == 1)? 0b011 : ((functionNo == 2)? 0b100 : ((functionNo == 3)? 0b110 : 0b111))) |
+                                  (state? 0b1000 : 0b0000));
+  }
+
+  // interrupts must be disabled
+  static void storeMessage(uint8_t n, Message message, Priority priority);
+  static void storeEnabled(uint8_t n, bool enabled);
+
+  static void registerFault();
+  static void resume();
+  static void reportFault();
+
   static void loadNextMessage();
+  static uint8_t nextRefreshSlot(uint16_t now);
+  static void expandMessage(Message message, MessageSpeed speed);
+  static void markPending(uint8_t n, Priority priority);
 
 private:
   static Message s_msgBuffer[MessageBufferSize];
@@ -53,11 +263,43 @@ private:
   static MessageBufferMask s_msgSpeed;
   static MessageBufferMask s_msgOneShot;
 
+  static Priority s_msgPriority[MessageBufferSize];
+  static MessageBufferMask s_msgPending[PriorityCount]; // written but not sent yet
+  static uint32_t s_msgPendingSince[MessageBufferSize];
+  static QueueStats s_queueStats[PriorityCount];
+
+  static uint16_t s_msgRefreshPeriod[MessageBufferSize];
+  static uint16_t s_msgLastSent[MessageBufferSize];
+  static uint16_t s_msgRefreshInterval[MessageBufferSize];
+
+  static MessageBufferMask s_msgFunctionCycle;
+  static uint8_t s_msgFunctions[MessageBufferSize]; // bit 0 - 3: f1 - f4, bit 4 - 6: next function to send (0: direction)
+
+  static bool s_adaptiveRefresh;
+  static uint16_t s_adaptiveKeepAlive;
+  static uint8_t s_adaptiveBurst;
+  static uint8_t s_msgBurst[MessageBufferSize]; // remaining immediate repetitions of a changed message
+
+  static uint32_t s_msgPacketCount[MessageBufferSize];
+  static uint32_t s_classPacketCount[PriorityCount];
+  static uint32_t s_idlePacketCount;
+
   static bool s_running;
 
+  static uint16_t s_faultBackOff;
+  static uint8_t s_faultMaxRetries;
+  static uint16_t s_faultStableTime;
+  static FaultHandler * s_faultHandler;
+  static FaultStats s_faultStats;
+  static volatile bool s_faultChanged; // s_faultStats has to be reported
+  static uint32_t s_faultTime; // last fault
+  static uint32_t s_faultSequenceStart; // first fault of the current sequence
+  static uint32_t s_resumeTime;
+
   static uint8_t s_currentMsgNumber;
-  static bool s_state;
-  static uint8_t s_bitCounter;
-  static MessageSpeed s_currentSpeed;
-  static Message s_currentMessage;
+
+  // precomputed ICR1 / OCR1A values of the current message, played back by onTimerOverflow()
+  static uint16_t s_waveTop[WaveformLength];
+  static uint16_t s_waveCompare[WaveformLength];
+  static uint8_t s_waveIndex;
 };
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Bit field of Size slots, stored in bytes so that the search functions can skip 8 empty slots at once
+template<uint8_t Size>
+class SlotMask
+{
+public:
+  static constexpr uint8_t WordCount = (Size + 7) / 8;
+
+  void clear()
+  {
+    for(uint8_t w = 0; w < WordCount; ++w)
+    {
+      m_words[w] = 0;
+    }
+  }
+
+  void set(uint8_t n)
+  {
+    m_words[n >> 3] |= (0x1 << (n & 0x7));
+  }
+  void reset(uint8_t n)
+  {
+    m_words[n >> 3] &= ~(0x1 << (n & 0x7));
+  }
+  void assign(uint8_t n, bool value)
+  {
+    if(value)
+    {
+      set(n);
+    }
+    else
+    {
+      reset(n);
+    }
+  }
+
+  bool test(uint8_t n) const
+  {
+    return m_words[n >> 3] & (0x1 << (n & 0x7));
+  }
+
+  bool any() const
+  {
+    for(uint8_t w = 0; w < WordCount; ++w)
+    {
+      if(m_words[w])
+        return true;
+    }
+    return false;
+  }
+
+  // lowest slot set in both masks, Size if there is none
+  uint8_t firstCommon(const SlotMask & other) const
+  {
+    for(uint8_t w = 0; w < WordCount; ++w)
+    {
+      uint8_t word = m_words[w] & other.m_words[w];
+      if(word)
+      {
+        uint8_t n = w << 3;
+        while(!(word & 0x1))
+        {
+          word >>= 1;
+          ++n;
+        }
+        return n;
+      }
+    }
+    return Size;
+  }
+
+  // next set slot after n (wrapping around, n itself is checked last), Size if there is none
+  uint8_t next(uint8_t n) const
+  {
+    uint8_t i = n;
+    uint8_t remaining = Size;
+    while(remaining)
+    {
+      i = (i + 1 < Size)? i + 1 : 0;
+      --remaining;
+      if(!m_words[i >> 3])
+      {
+        uint8_t skip = 7 - (i & 0x7); // rest of the empty word
+        if(skip > remaining) skip = remaining;
+        if(i + skip >= Size) skip = Size - 1 - i;
+        i += skip;
+        remaining -= skip;
+        continue;
+      }
+      if(test(i))
+        return i;
+    }
+    return Size;
+  }
+
+private:
+  uint8_t m_words[WordCount];
+};
@@ -0,0 +1,112 @@
+#include "switcharray.h"
+
+#include "motorola.h"
+
+void SwitchArray::start(const uint8_t * decoderAddresses, const uint8_t * msgSlots)
+{
+  for(uint8_t arrayNo = 0; arrayNo < ArrayCount; ++arrayNo)
+  {
+    s_decoderAddresses[arrayNo] = decoderAddresses[arrayNo];
+    s_msgSlots[arrayNo] = msgSlots[arrayNo];
+
+    s_arrays[arrayNo].jobsFree = 0;
+    s_arrays[arrayNo].jobsNext = 0;
+    s_arrays[arrayNo].phase = Phase::Idle;
+
+    Motorola::setMessageSpeed(msgSlots[arrayNo], true);
+    Motorola::setMessageOneShot(msgSlots[arrayNo], true);
+    Motorola::setMessagePriority(msgSlots[arrayNo], Motorola::PriorityCommand);
+  }
+}
+
+bool SwitchArray::set(uint8_t arrayNo, uint8_t states, SwitchArray::CompletionHandler * handler)
+{
+  if(arrayNo >= ArrayCount)
+    return false;
+
+  ArrayState & array = s_arrays[arrayNo];
+  if((array.jobsFree + 1) % JobQueueSize == array.jobsNext)
+    return false; // job queue overflow
+
+  array.jobs[array.jobsFree].states = states;
+  array.jobs[array.jobsFree].handler = handler;
+  array.jobsFree = (array.jobsFree + 1) % JobQueueSize;
+  return true;
+}
+
+bool SwitchArray::idle(uint8_t arrayNo)
+{
+  if(arrayNo >= ArrayCount)
+    return true;
+
+  return s_arrays[arrayNo].phase == Phase::Idle && s_arrays[arrayNo].jobsNext == s_arrays[arrayNo].jobsFree;
+}
+
+void SwitchArray::update()
+{
+  unsigned long now = millis();
+  for(uint8_t arrayNo = 0; arrayNo < ArrayCount; ++arrayNo)
+  {
+    updateArray(arrayNo, now);
+  }
+}
+
+void SwitchArray::sendSwitchMessage(uint8_t arrayNo, bool state)
+{
+  ArrayState & array = s_arrays[arrayNo];
+  uint8_t states = array.jobs[array.jobsNext].states;
+  uint8_t switchAddress = 2 * array.switchNo + ((states & (0x1 << array.switchNo))? 1 : 0);
+
+  Motorola::setMessage(s_msgSlots[arrayNo], Motorola::switchMessage(s_decoderAddresses[arrayNo], switchAddress, state));
+  Motorola::enableMessage(s_msgSlots[arrayNo]);
+}
+
+void SwitchArray::updateArray(uint8_t arrayNo, unsigned long now)
+{
+  ArrayState & array = s_arrays[arrayNo];
+
+  switch(array.phase)
+  {
+    case Phase::Idle:
+      if(array.jobsNext == array.jobsFree)
+        return;
+      array.switchNo = 0;
+      break;
+
+    case Phase::Activate:
+      if((now - array.phaseStart) < ActivateTime || Motorola::messageEnabled(s_msgSlots[arrayNo]))
+        return;
+      array.phaseStart = now;
+      array.phase = Phase::Release;
+      sendSwitchMessage(arrayNo, false);
+      return;
+
+    case Phase::Release:
+      if((now - array.phaseStart) < ReleaseTime || Motorola::messageEnabled(s_msgSlots[arrayNo]))
+        return;
+      if(++array.switchNo < SwitchCount)
+        break;
+
+      // all switches operated: job is done
+      {
+        CompletionHandler * handler = array.jobs[array.jobsNext].handler;
+        array.jobsNext = (array.jobsNext + 1) % JobQueueSize;
+        array.phase = Phase::Idle;
+        if(handler)
+        {
+          handler(arrayNo);
+        }
+      }
+      return;
+  }
+
+  // energize next switch
+  array.phaseStart = now;
+  array.phase = Phase::Activate;
+  sendSwitchMessage(arrayNo, true);
+}
+
+SwitchArray::ArrayState SwitchArray::s_arrays[SwitchArray::ArrayCount];
+
+uint8_t SwitchArray::s_decoderAddresses[SwitchArray::ArrayCount];
+uint8_t SwitchArray::s_msgSlots[SwitchArray::ArrayCount];
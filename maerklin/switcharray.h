@@ -0,0 +1,66 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Non-blocking switch array actuation
+// Every switch array owns a queue of jobs (a target configuration of its 4 switches).
+// update() has to be called from loop() and advances the jobs of all arrays in parallel:
+// each switch is energized for ActivateTime ms and released for ReleaseTime ms,
+// each array sends its packets through a dedicated Motorola one-shot slot.
+class SwitchArray
+{
+public:
+  using CompletionHandler = void(uint8_t arrayNo);
+
+  static constexpr uint8_t ArrayCount = 2;
+  static constexpr uint8_t SwitchCount = 4;
+  static constexpr uint8_t JobQueueSize = 4;
+
+  static constexpr unsigned long ActivateTime = 150; // ms
+  static constexpr unsigned long ReleaseTime = 50; // ms
+
+  static void start(const uint8_t * decoderAddresses, const uint8_t * msgSlots);
+
+  // queue a new configuration for the given array (first 4 bits: 0 = straight, 1 = diverging)
+  // handler is called from update() as soon as all switches have been operated
+  static bool set(uint8_t arrayNo, uint8_t states, CompletionHandler * handler = nullptr);
+  static bool idle(uint8_t arrayNo); // no job queued or in progress
+
+  static void update();
+
+private:
+  SwitchArray() = default;
+
+  enum class Phase : uint8_t
+  {
+    Idle,
+    Activate,
+    Release
+  };
+
+  using Job = struct
+  {
+    uint8_t states;
+    CompletionHandler * handler;
+  };
+
+  using ArrayState = struct
+  {
+    Job jobs[JobQueueSize];
+    uint8_t jobsFree;
+    uint8_t jobsNext;
+
+    Phase phase;
+    uint8_t switchNo;
+    unsigned long phaseStart;
+  };
+
+  static void sendSwitchMessage(uint8_t arrayNo, bool state);
+  static void updateArray(uint8_t arrayNo, unsigned long now);
+
+private:
+  static ArrayState s_arrays[ArrayCount];
+
+  static uint8_t s_decoderAddresses[ArrayCount];
+  static uint8_t s_msgSlots[ArrayCount];
+};
@@ -0,0 +1,92 @@
+#include "logger.h"
+
+bool Logger::drain()
+{
+  if(CompiledLevel == LevelNone)
+    return true;
+
+  while(s_recordsNext != s_recordsFree)
+  {
+    const Record & record = s_records[s_recordsNext];
+    if(Serial.availableForWrite() < maxLength(record))
+      return false;
+
+    if(record.prefix)
+    {
+      Serial.print(record.prefix);
+    }
+    Serial.print(record.value, record.base);
+    if(record.suffix)
+    {
+      Serial.print(record.suffix);
+    }
+    Serial.println();
+    s_recordsNext = (s_recordsNext + 1) % RecordQueueSize;
+  }
+
+  // after the records that were queued before the drops
+  if(s_dropped)
+  {
+    constexpr uint8_t droppedLength = 20; // "Log dropped 65535" + line end
+    if(Serial.availableForWrite() < droppedLength)
+      return false;
+
+    uint8_t SaveSREG = SREG;
+    cli();
+    uint16_t dropped = s_dropped;
+    s_dropped = 0;
+    SREG = SaveSREG;
+    Serial.print(F("Log dropped ")); Serial.println(dropped);
+  }
+  return true;
+}
+
+uint16_t Logger::droppedRecords()
+{
+  uint8_t SaveSREG = SREG;
+  cli();
+  uint16_t dropped = s_droppedTotal;
+  SREG = SaveSREG;
+  return dropped;
+}
+
+void Logger::append(const __FlashStringHelper * prefix, uint32_t value, const __FlashStringHelper * suffix,
+                    uint8_t base)
+{
+  uint8_t SaveSREG = SREG;
+  cli();
+  uint8_t slot = s_recordsFree;
+  uint8_t next = (slot + 1) % RecordQueueSize;
+  if(next == s_recordsNext)
+  {
+    ++s_dropped;
+    ++s_droppedTotal;
+  }
+  else
+  {
+    s_records[slot] = {prefix, suffix, value, base};
+    s_recordsFree = next;
+  }
+  SREG = SaveSREG;
+}
+
+// line length with the longest value in the record's base
+uint8_t Logger::maxLength(const Logger::Record & record)
+{
+  uint8_t length = (record.base == HEX)? 8 : ((record.base == DEC)? 10 : 32);
+  if(record.prefix)
+  {
+    length += strlen_P(reinterpret_cast<PGM_P>(record.prefix));
+  }
+  if(record.suffix)
+  {
+    length += strlen_P(reinterpret_cast<PGM_P>(record.suffix));
+  }
+  return length + 2;
+}
+
+Logger::Record Logger::s_records[Logger::RecordQueueSize];
+volatile uint8_t Logger::s_recordsFree = 0;
+volatile uint8_t Logger::s_recordsNext = 0;
+volatile uint16_t Logger::s_dropped = 0;
+volatile uint16_t Logger::s_droppedTotal = 0;
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Non-blocking serial log
+// A record is a line "<prefix><value><suffix>" with both strings in program memory. error(), info() and debug()
+// only append it to a ring buffer (also from interrupts); drain() prints the records from loop() as far as they
+// fit into the serial send buffer, so logging never waits for the UART. Records that do not fit into the ring
+// buffer are dropped and counted, the count is printed once there is room again.
+// Calls above CompiledLevel are removed at compile time, LevelNone removes all logging.
+class Logger
+{
+public:
+  enum Level : uint8_t
+  {
+    LevelNone,
+    LevelError,
+    LevelInfo,
+    LevelDebug
+  };
+
+  static constexpr Level CompiledLevel = LevelDebug;
+  static constexpr uint8_t RecordQueueSize = 16;
+
+  static void error(const __FlashStringHelper * prefix, uint32_t value, const __FlashStringHelper * suffix = nullptr,
+                    uint8_t base = DEC)
+  {
+    if(CompiledLevel >= LevelError)
+      append(prefix, value, suffix, base);
+  }
+
+  static void info(const __FlashStringHelper * prefix, uint32_t value, const __FlashStringHelper * suffix = nullptr,
+                   uint8_t base = DEC)
+  {
+    if(CompiledLevel >= LevelInfo)
+      append(prefix, value, suffix, base);
+  }
+
+  static void debug(const __FlashStringHelper * prefix, uint32_t value, const __FlashStringHelper * suffix = nullptr,
+                    uint8_t base = DEC)
+  {
+    if(CompiledLevel >= LevelDebug)
+      append(prefix, value, suffix, base);
+  }
+
+  // prints as many records as the serial send buffer takes without blocking, true if none are left
+  static bool drain();
+
+  static uint16_t droppedRecords(); // since startup
+
+private:
+  Logger() = default;
+
+  using Record = struct
+  {
+    const __FlashStringHelper * prefix;
+    const __FlashStringHelper * suffix;
+    uint32_t value;
+    uint8_t base;
+  };
+
+  static void append(const __FlashStringHelper * prefix, uint32_t value, const __FlashStringHelper * suffix,
+                     uint8_t base);
+  static uint8_t maxLength(const Record & record);
+
+  static Record s_records[RecordQueueSize];
+  static volatile uint8_t s_recordsFree;
+  static volatile uint8_t s_recordsNext;
+  static volatile uint16_t s_dropped; // not reported yet
+  static volatile uint16_t s_droppedTotal;
+};
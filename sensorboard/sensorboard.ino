@@ -1,4 +1,9 @@
-#include "can.h"
+#include "logger.h"
+
+#include <can.h>
+#include <EEPROM.h>
+
+using CAN = CANBus<4, 16, 4>; // receives only remote requests, but sends bursts of contact events
 
 constexpr int PinAdr0 = 14; // A0
 constexpr int PinAdr1 = 15; // A1
@@ -12,17 +17,85 @@ constexpr int MultiplexSelectA = 7; // D7 LSB
 constexpr int MultiplexSelectB = 6; // D6
 constexpr int MultiplexSelectC = 5; // D5 MSB
 
+// D3 - D7 are bits 3 - 7 of port D: one write to PORTD selects the input of both multiplexers, one read of PIND
+// samples both. The other bits of PORTD (serial, CAN interrupt) are inputs or owned by the UART, so the
+// read-modify-write cannot disturb them.
+constexpr uint8_t multiplexSelectMask = _BV(MultiplexSelectA) | _BV(MultiplexSelectB) | _BV(MultiplexSelectC);
+
 // remapping to get consistent input pin numbering
 constexpr uint8_t pinToContactMap[16] = {0, 1, 2, 3, 4, 5, 6, 7, 11, 10, 9, 8, 15, 14, 13, 12};
 
+uint8_t multiplexSelect[8]; // PORTD bits for multiplexer input 0 - 7
+uint16_t contactMasks[16]; // bit of pinToContactMap[pinNumber]
+
+// The contacts are sampled from the Timer1 overflow interrupt every SamplePeriod, so a timestamp is the sample tick
+// (in ms) of the first sample of the new level. An edge is reported debounceIn / debounceOut samples later.
+constexpr uint8_t SamplePeriod = 1; // ms
+constexpr uint16_t SampleTimerTop = 1999; // ICR1 at fT1 = fCPU / 8
+
 uint32_t timestamps[16] = {0}; // last start of track signal
 uint32_t durations[16] = {0}; // last duration of track signal
-uint16_t inputStates = 0; // bit field: input pin X is currently high
-uint32_t debounceIn = 20; // time in milliseconds before input edge H/L is detected
-uint32_t debounceOut = 20; // time in milliseconds before an input edge L/H after an edge H/L is detected
+volatile uint16_t inputStates = 0; // bit field, debounced: contact X is currently closed
+constexpr uint8_t defaultDebounce = 20; // samples, unless configured over CAN (see setDebounceConfig())
+uint8_t debounceIn[16]; // samples a contact has to be closed before the closing edge is accepted
+uint8_t debounceOut[16]; // samples a contact has to be open before the opening edge is accepted
+
+// EEPROM layout of the debounce configuration: marker, then debounceIn and debounceOut of each contact
+constexpr int eepromDebounceMarker = 0;
+constexpr uint8_t debounceMarker = 0xD1; // anything else: not configured yet, use defaultDebounce
+constexpr int eepromDebounce = 1;
+volatile bool debounceConfigChanged = false; // set by the CAN handler, stored and answered from loop()
+
+// Vertical counter: bit X of plane k is bit k of the samples contact X still has to differ from its debounced
+// state. Counts down while it differs, is reloaded with the debounce time of the next edge while it does not.
+constexpr uint8_t DebounceBits = 6; // debounce times up to 63 samples
+uint16_t debounceCount[DebounceBits];
+uint16_t debouncePresetIn[DebounceBits]; // planes of debounceIn
+uint16_t debouncePresetOut[DebounceBits]; // planes of debounceOut
+uint16_t debounceReloaded; // contacts whose counter was reloaded by the last step, see debounce()
+uint32_t levelStart[16]; // sample tick since which contact X differs from its debounced state
+
+// one per edge, with the tick of the first sample of the new level: the debounce time may change meanwhile
+using EdgeEvent = struct
+{
+  uint32_t tick;
+  uint8_t contactNumber;
+  bool closed;
+};
+
+constexpr uint8_t EdgeQueueSize = 24;
+volatile EdgeEvent edgeQueue[EdgeQueueSize];
+volatile uint8_t edgeQueueFree = 0; // written by the interrupt
+volatile uint8_t edgeQueueNext = 0; // written by loop()
+volatile uint16_t droppedEdgeEvents = 0; // queue was full, the edges are missing from the CAN messages
+
+volatile uint32_t sampleTick = 0;
+
+// the sampling rate is fixed by Timer1, the loop rate shows how much time serial and CAN leave to loop()
+uint32_t loopWindowStart = 0; // ms
+uint32_t loopWindowCount = 0;
+uint32_t loopsPerSecond = 0; // of the last full second, sent after the driver stats
+
+constexpr uint32_t canBitRate = CAN::BitRate100k; // used if no traffic is heard on startup
+constexpr uint16_t canDetectTimeout = 200; // ms per bit rate
+constexpr uint16_t canSelfTestFrames = 16; // loopback test on startup
+constexpr uint16_t sendTimeout = 20; // ms to wait for a free send slot before a contact event is dropped
 
 CAN::StdIdentifier canAddress = 0x300;
 CAN::StdIdentifier canAddressMask = 0x7F0; //take 16 addresses
+CAN::StdIdentifier canStatsAddress = 0x400; // driver stats are sent on request, see sendStats()
+CAN::StdIdentifier canConfigAddress = 0x408; // debounce configuration, see setDebounceConfig()
+CAN::StdIdentifier canPassageAddress = 0x500; // train passages over contact pairs, see sendPassage()
+
+// Contacts 2k and 2k + 1 of a pair lie pairSpacing apart along the track, and both are closed while a train is
+// over them. Instead of the 4 contact events, one passage is sent when both have opened again.
+constexpr uint8_t contactPairs = 0x00; // bit k: contacts 2k and 2k + 1 are a pair
+constexpr uint16_t pairSpacing = 50; // mm
+constexpr uint32_t maxPassageTime = 10000; // ms between the closings of a pair that still count as one passage
+uint16_t passageClosed = 0; // bit X: contact X closed during the current passage over its pair
+uint16_t passageOpened = 0; // bit X: ... and opened again
+constexpr uint8_t configFrameCount = 4; // 4 contacts per frame
+constexpr uint8_t configSetOffset = 4; // canConfigAddress + configSetOffset: set request
 
 void encodeLong(const uint32_t & value, uint8_t * buffer)
 {
@@ -34,32 +107,395 @@ void encodeLong(const uint32_t & value, uint8_t * buffer)
 
 void send(uint8_t pin, uint32_t timestamp, uint32_t duration)
 {
-  CAN::MessageEvent * msg = CAN::prepareMessage();
+  CAN::MessageEvent * msg = CAN::reserveMessage(CAN::SendWait, sendTimeout);
   if(!msg)
     return;
-  msg->hasExtIdentifier = false;
-  msg->stdIdentifier = (canAddress & canAddressMask) |
-                       (pin & ~canAddressMask);
-  msg->isRTR = false;
-  msg->length = 8;
+  msg->setStdIdentifier((canAddress & canAddressMask) | (pin & ~canAddressMask));
+  msg->setLength(8);
   encodeLong(timestamp, msg->content);
   encodeLong(duration, msg->content + 4);
   CAN::commitMessage(msg);
 }
 
+bool paired(uint8_t contactNumber)
+{
+  return contactPairs & (1 << (contactNumber >> 1));
+}
+
+// direction (identifier bit 0: the odd contact closed first), timestamp of the first closing, speed and length
+void sendPassage(uint8_t firstContact)
+{
+  uint8_t secondContact = firstContact + 1;
+  int32_t offset = (int32_t)(timestamps[secondContact] - timestamps[firstContact]);
+  bool reverse = (offset < 0);
+  uint32_t interval = reverse? -offset : offset; // ms
+  if(!interval)
+  {
+    interval = SamplePeriod; // closed in the same sample
+  }
+
+  uint32_t speed = (uint32_t) pairSpacing * 1000 / interval; // mm/s
+  uint64_t closedTime = (uint64_t) durations[firstContact] + durations[secondContact]; // ms, both contacts
+  uint32_t length = (uint32_t)(closedTime * pairSpacing / (2 * interval)); // mm
+  if(speed > UINT16_MAX)
+  {
+    speed = UINT16_MAX;
+  }
+  if(length > UINT16_MAX)
+  {
+    length = UINT16_MAX;
+  }
+
+  Logger::info(F("Pair "), firstContact >> 1, reverse? F(" passed reverse") : F(" passed forward"));
+  Logger::debug(F("Speed "), speed, F(" mm/s"));
+  Logger::debug(F("Length "), length, F(" mm"));
+
+  CAN::MessageEvent * msg = CAN::reserveMessage(CAN::SendWait, sendTimeout);
+  if(!msg)
+    return;
+  msg->setStdIdentifier((canPassageAddress & canAddressMask) | firstContact | (reverse? 0x001 : 0x000));
+  msg->setLength(8);
+  encodeLong(reverse? timestamps[secondContact] : timestamps[firstContact], msg->content);
+  msg->content[4] = (uint8_t) (speed & 0x00FF);
+  msg->content[5] = (uint8_t)((speed & 0xFF00) >> 8);
+  msg->content[6] = (uint8_t) (length & 0x00FF);
+  msg->content[7] = (uint8_t)((length & 0xFF00) >> 8);
+  CAN::commitMessage(msg);
+}
+
+// A passage is complete once both contacts of the pair have closed and opened again. A contact that closes twice,
+// or long after the other one, starts a new passage; a train that only covered one contact is not reported.
+void passageEdge(uint8_t contactNumber, bool closed)
+{
+  uint16_t pairMask = 0b11 << (contactNumber & ~0x01);
+  uint16_t contactMask = 1 << contactNumber;
+  uint8_t otherContact = contactNumber ^ 0x01;
+
+  if(closed)
+  {
+    bool stale = (passageClosed & (1 << otherContact))
+                 && (timestamps[contactNumber] - timestamps[otherContact] > maxPassageTime);
+    if((passageClosed & contactMask) || stale)
+    {
+      passageClosed &= ~pairMask;
+      passageOpened &= ~pairMask;
+    }
+    passageClosed |= contactMask;
+    return;
+  }
+
+  if(!(passageClosed & contactMask))
+    return;
+  passageOpened |= contactMask;
+  if((passageOpened & pairMask) != pairMask)
+    return;
+
+  passageClosed &= ~pairMask;
+  passageOpened &= ~pairMask;
+  sendPassage(contactNumber & ~0x01);
+}
+
+// answers a remote request for canStatsAddress with CAN::StatsFrameCount frames, followed by one with the loop rate and
+// the numbers of dropped edge events and log records
+void sendStats()
+{
+  CAN::Stats stats;
+  CAN::getStats(&stats);
+  for(uint8_t frameNo = 0; frameNo < CAN::StatsFrameCount; ++frameNo)
+  {
+    CAN::MessageEvent * msg = CAN::reserveMessage();
+    if(!msg)
+      return;
+    msg->setStdIdentifier(canStatsAddress + frameNo);
+    msg->setLength(CAN::encodeStats(&stats, frameNo, msg->content));
+    CAN::commitMessage(msg);
+  }
+
+  CAN::MessageEvent * msg = CAN::reserveMessage();
+  if(!msg)
+    return;
+  msg->setStdIdentifier(canStatsAddress + CAN::StatsFrameCount);
+  uint8_t SaveSREG = SREG;
+  cli();
+  uint16_t droppedEdges = droppedEdgeEvents; // written by the sampling interrupt
+  SREG = SaveSREG;
+  uint16_t droppedLogRecords = Logger::droppedRecords();
+  msg->setLength(8);
+  encodeLong(loopsPerSecond, msg->content);
+  msg->content[4] = (uint8_t) (droppedEdges & 0x00FF);
+  msg->content[5] = (uint8_t)((droppedEdges & 0xFF00) >> 8);
+  msg->content[6] = (uint8_t) (droppedLogRecords & 0x00FF);
+  msg->content[7] = (uint8_t)((droppedLogRecords & 0xFF00) >> 8);
+  CAN::commitMessage(msg);
+}
+
+void setupScan()
+{
+  for(uint8_t select = 0; select < 8; ++select)
+  {
+    multiplexSelect[select] = ((select & 0b0001)? _BV(MultiplexSelectA) : 0)
+                            | ((select & 0b0010)? _BV(MultiplexSelectB) : 0)
+                            | ((select & 0b0100)? _BV(MultiplexSelectC) : 0);
+  }
+  for(uint8_t pinNumber = 0; pinNumber < 16; ++pinNumber)
+  {
+    contactMasks[pinNumber] = 1 << pinToContactMap[pinNumber];
+  }
+}
+
+// one sweep over both multiplexers, bit X set: contact X is closed
+uint16_t scanContacts()
+{
+  uint16_t closed = 0;
+  for(uint8_t select = 0; select < 8; ++select)
+  {
+    PORTD = (PORTD & ~multiplexSelectMask) | multiplexSelect[select];
+    __asm__ __volatile__("nop\n\tnop"); // multiplexer propagation and input synchronizer
+    uint8_t sample = PIND;
+    if(!(sample & _BV(MultiplexInputA))) // inverting input logic
+    {
+      closed |= contactMasks[select];
+    }
+    if(!(sample & _BV(MultiplexInputB)))
+    {
+      closed |= contactMasks[select + 8];
+    }
+  }
+  return closed;
+}
+
+// sets the debounce time of the contacts in contactMask, in samples (1 - 63)
+void setDebounce(uint16_t contactMask, uint8_t samplesIn, uint8_t samplesOut)
+{
+  constexpr uint8_t maxSamples = (1 << DebounceBits) - 1;
+  samplesIn = constrain(samplesIn, 1, maxSamples);
+  samplesOut = constrain(samplesOut, 1, maxSamples);
+
+  for(uint8_t contactNumber = 0; contactNumber < 16; ++contactNumber)
+  {
+    if(contactMask & (1 << contactNumber))
+    {
+      debounceIn[contactNumber] = samplesIn;
+      debounceOut[contactNumber] = samplesOut;
+    }
+  }
+
+  uint8_t SaveSREG = SREG;
+  cli();
+  for(uint8_t k = 0; k < DebounceBits; ++k)
+  {
+    debouncePresetIn[k] = (debouncePresetIn[k] & ~contactMask) | ((samplesIn & (1 << k))? contactMask : 0);
+    debouncePresetOut[k] = (debouncePresetOut[k] & ~contactMask) | ((samplesOut & (1 << k))? contactMask : 0);
+  }
+  SREG = SaveSREG;
+}
+
+// one step of the vertical counter for all contacts at sample tick, returns the contacts whose debounced state changed
+uint16_t debounce(uint16_t closed, uint32_t tick)
+{
+  uint16_t states = inputStates;
+  uint16_t differs = closed ^ states;
+
+  uint16_t starting = differs & debounceReloaded; // counting down from this sample on
+  for(uint8_t contactNumber = 0; starting; ++contactNumber, starting >>= 1)
+  {
+    if(starting & 0x0001)
+    {
+      levelStart[contactNumber] = tick;
+    }
+  }
+
+  uint16_t borrow = differs;
+  uint16_t remaining = 0;
+  for(uint8_t k = 0; k < DebounceBits; ++k)
+  {
+    uint16_t count = debounceCount[k];
+    debounceCount[k] = count ^ borrow;
+    borrow &= ~count;
+    remaining |= debounceCount[k];
+  }
+
+  uint16_t edges = differs & ~remaining;
+  states ^= edges;
+
+  uint16_t reload = ~differs | edges;
+  for(uint8_t k = 0; k < DebounceBits; ++k)
+  {
+    uint16_t preset = (debouncePresetIn[k] & ~states) | (debouncePresetOut[k] & states);
+    debounceCount[k] = (debounceCount[k] & ~reload) | (preset & reload);
+  }
+  debounceReloaded = reload;
+
+  inputStates = states;
+  return edges;
+}
+
+void queueEdge(uint8_t contactNumber)
+{
+  uint8_t slot = edgeQueueFree;
+  uint8_t next = (slot + 1) % EdgeQueueSize;
+  if(next == edgeQueueNext)
+  {
+    ++droppedEdgeEvents;
+    return;
+  }
+  edgeQueue[slot].tick = levelStart[contactNumber];
+  edgeQueue[slot].contactNumber = contactNumber;
+  edgeQueue[slot].closed = inputStates & (1 << contactNumber);
+  edgeQueueFree = next;
+}
+
+ISR(TIMER1_OVF_vect)
+{
+  uint32_t tick = sampleTick + 1;
+  sampleTick = tick;
+
+  uint16_t edges = debounce(scanContacts(), tick);
+  for(uint8_t contactNumber = 0; edges; ++contactNumber, edges >>= 1)
+  {
+    if(edges & 0x0001)
+    {
+      queueEdge(contactNumber);
+    }
+  }
+}
+
+void loadDebounceConfig()
+{
+  bool configured = (EEPROM.read(eepromDebounceMarker) == debounceMarker);
+  for(uint8_t contactNumber = 0; contactNumber < 16; ++contactNumber)
+  {
+    uint8_t samplesIn = configured? EEPROM.read(eepromDebounce + 2 * contactNumber) : defaultDebounce;
+    uint8_t samplesOut = configured? EEPROM.read(eepromDebounce + 2 * contactNumber + 1) : defaultDebounce;
+    setDebounce(1 << contactNumber, samplesIn, samplesOut);
+  }
+}
+
+void storeDebounceConfig()
+{
+  for(uint8_t contactNumber = 0; contactNumber < 16; ++contactNumber)
+  {
+    EEPROM.update(eepromDebounce + 2 * contactNumber, debounceIn[contactNumber]);
+    EEPROM.update(eepromDebounce + 2 * contactNumber + 1, debounceOut[contactNumber]);
+  }
+  EEPROM.update(eepromDebounceMarker, debounceMarker);
+}
+
+// answers a remote request for canConfigAddress with configFrameCount frames:
+// debounceIn and debounceOut of 4 contacts each
+void sendDebounceConfig()
+{
+  for(uint8_t frameNo = 0; frameNo < configFrameCount; ++frameNo)
+  {
+    CAN::MessageEvent * msg = CAN::reserveMessage();
+    if(!msg)
+      return;
+    msg->setStdIdentifier(canConfigAddress + frameNo);
+    msg->setLength(8);
+    for(uint8_t i = 0; i < 4; ++i)
+    {
+      msg->content[2 * i] = debounceIn[4 * frameNo + i];
+      msg->content[2 * i + 1] = debounceOut[4 * frameNo + i];
+    }
+    CAN::commitMessage(msg);
+  }
+}
+
+// set request at canConfigAddress + configSetOffset: contact number (0xFF: all), debounceIn, debounceOut (samples);
+// takes effect at once, loop() stores it in EEPROM (several ms per byte) and answers like a remote request
+void setDebounceConfig(const CAN::MessageEvent * msg)
+{
+  if(msg->length() < 3)
+    return;
+
+  uint8_t contactNumber = msg->content[0];
+  if(contactNumber >= 16 && contactNumber != 0xFF)
+    return;
+
+  setDebounce((contactNumber == 0xFF)? 0xFFFF : (1 << contactNumber), msg->content[1], msg->content[2]);
+  Logger::info(F("Debounce set for "), contactNumber);
+  debounceConfigChanged = true;
+}
+
+void startSampling()
+{
+  for(uint8_t k = 0; k < DebounceBits; ++k)
+  {
+    debounceCount[k] = debouncePresetIn[k]; // all contacts start open
+  }
+  debounceReloaded = 0xFFFF;
+
+  uint8_t SaveSREG = SREG;
+  cli();
+  TCCR1A = 0b00000010;
+  TCCR1B = 0b00011010; // fast PWM without outputs, fT1 = fCPU / 8, TOP = ICR1
+  ICR1 = SampleTimerTop;
+  TIMSK1 |= (1 << TOIE1);
+  TIFR1 = _BV(TOV1); // clear a pending overflow, the flag is cleared by writing a 1
+  TCNT1 = 0;
+  SREG = SaveSREG;
+}
+
+void countLoops(uint32_t now)
+{
+  ++loopWindowCount;
+  uint32_t elapsed = now - loopWindowStart;
+  if(elapsed < 1000)
+    return;
+
+  bool first = (loopsPerSecond == 0); // reported once after startup
+  loopsPerSecond = loopWindowCount * 1000 / elapsed;
+  loopWindowCount = 0;
+  loopWindowStart = now;
+  if(first)
+  {
+    Logger::info(F("Loop rate "), loopsPerSecond, F(" loops/s"));
+  }
+}
+
+bool nextEdgeEvent(EdgeEvent * event)
+{
+  uint8_t slot = edgeQueueNext;
+  if(slot == edgeQueueFree)
+    return false;
+
+  event->tick = edgeQueue[slot].tick;
+  event->contactNumber = edgeQueue[slot].contactNumber;
+  event->closed = edgeQueue[slot].closed;
+  edgeQueueNext = (slot + 1) % EdgeQueueSize;
+  return true;
+}
+
 void msgHandler(const CAN::MessageEvent * msg)
 {
-  if(msg->isRTR)
+  if((msg->stdIdentifier() & canAddressMask) == canStatsAddress)
+  {
+    if(msg->stdIdentifier() == canConfigAddress + configSetOffset && !msg->isRTR())
+    {
+      setDebounceConfig(msg);
+    }
+    else if(msg->stdIdentifier() == canConfigAddress && msg->isRTR())
+    {
+      sendDebounceConfig();
+    }
+    else if(msg->isRTR())
+    {
+      sendStats();
+    }
+    return;
+  }
+
+  if(msg->isRTR())
   {
-    Serial.print("Request for 0x"); Serial.print(msg->stdIdentifier, HEX);
+    Logger::debug(F("Request for 0x"), msg->stdIdentifier(), nullptr, HEX);
   }
-  uint8_t contactNumber = msg->stdIdentifier & 0x00F;
+  uint8_t contactNumber = msg->stdIdentifier() & 0x00F;
   send(contactNumber, timestamps[contactNumber], durations[contactNumber]);
 }
 
 void errorHandler(const CAN::ErrorEvent * error)
 {
-  Serial.print("Error 0x"); Serial.println(error->flags, HEX);
+  Logger::error(F("Error 0x"), error->flags, nullptr, HEX);
 }
 
 void setup()
@@ -68,81 +504,91 @@ void setup()
   canAddress |= digitalRead(PinAdr1)? 0x20 : 0x00;
   canAddress |= digitalRead(PinAdr2)? 0x40 : 0x00;
   canAddress |= digitalRead(PinAdr3)? 0x80 : 0x00;
+  canStatsAddress |= canAddress & 0x0F0;
+  canConfigAddress |= canAddress & 0x0F0;
+  canPassageAddress |= canAddress & 0x0F0;
 
-  CAN::start(&msgHandler, &errorHandler);
-  CAN::setReceiveFilter(canAddress, canAddressMask);
+  const CAN::ReceiveFilter filters[] = {
+    {false, canAddress, canAddressMask},
+    {false, canStatsAddress, canAddressMask}
+  };
+  uint32_t bitRate = CAN::detectBitRate(canDetectTimeout);
+  if(!bitRate)
+  {
+    bitRate = canBitRate;
+  }
+  CAN::start(&msgHandler, &errorHandler, bitRate);
+  CAN::setReceiveFilters(filters, 2);
 
   pinMode(MultiplexInputA, INPUT);
   pinMode(MultiplexInputB, INPUT);
   pinMode(MultiplexSelectA, OUTPUT);
   pinMode(MultiplexSelectB, OUTPUT);
   pinMode(MultiplexSelectC, OUTPUT);
+  setupScan();
 
   Serial.begin(9600);
+  Logger::info(F("CAN bit rate "), bitRate);
+
+  CAN::BenchmarkResult result;
+  bool passed = CAN::benchmark(canSelfTestFrames, &result);
+  Logger::info(passed? F("CAN self-test passed: ") : F("CAN self-test FAILED: "), result.framesPerSecond, F(" frames/s"));
+  Logger::info(F("CAN self-test max latency "), result.maxLatency, F(" us"));
+
+  loadDebounceConfig();
+  startSampling();
+  loopWindowStart = millis();
 }
 
 void loop()
 {
-  for(uint8_t pinNumber = 0; pinNumber < 16; ++pinNumber)
-  {
-    digitalWrite(MultiplexSelectA, (pinNumber & 0b0001)? HIGH : LOW);
-    digitalWrite(MultiplexSelectB, (pinNumber & 0b0010)? HIGH : LOW);
-    digitalWrite(MultiplexSelectC, (pinNumber & 0b0100)? HIGH : LOW);
-    int inputPin = (pinNumber & 0b1000)? MultiplexInputB : MultiplexInputA;
-    uint8_t contactNumber = pinToContactMap[pinNumber];
-    uint16_t contactMask = 1 << contactNumber;
+  countLoops(millis());
 
-    // the multiplexers are really quick -
-    // the Arduino is slow enough that we don't have to delay reading the data
+  if(debounceConfigChanged)
+  {
+    debounceConfigChanged = false; // a set request arriving meanwhile is stored in the next round
+    storeDebounceConfig();
+    sendDebounceConfig();
+  }
 
-    uint32_t now = millis();
-    if(digitalRead(inputPin) == LOW) // inverting input logic
+  EdgeEvent event;
+  while(nextEdgeEvent(&event))
+  {
+    uint8_t contactNumber = event.contactNumber;
+    if(event.closed)
     {
-	  // switch was activated
-	  
-      uint32_t lastFallingEdge = timestamps[contactNumber] + durations[contactNumber];
-      uint32_t timeSinceLastFallingEdge = now - lastFallingEdge;
+      // switch was activated
+      timestamps[contactNumber] = event.tick * SamplePeriod;
 
-      // handle timer overflow
-      if((inputStates & contactMask) == 0 && (now < lastFallingEdge))
-      {
-        timeSinceLastFallingEdge = UINT32_MAX - lastFallingEdge + now;
-      }
+      Logger::info(nullptr, contactNumber, F(" close"));
 
-      if((inputStates & contactMask) == 0 && (timeSinceLastFallingEdge > debounceOut))
+      if(paired(contactNumber))
       {
-        Serial.print(contactNumber); Serial.println(" close");
-
-        timestamps[contactNumber] = now;
-        inputStates |= contactMask;
-
-		// Send message with timestamp and zero duration
-        send(contactNumber, timestamps[contactNumber], 0);
+        passageEdge(contactNumber, true);
+        continue;
       }
+
+      // Send message with timestamp and zero duration
+      send(contactNumber, timestamps[contactNumber], 0);
     }
     else
     {
-	  // switch was deactivated
-	  
-      uint32_t timeSinceLastRisingEdge = now - timestamps[contactNumber];
+      // switch was deactivated
+      uint32_t fallingEdge = event.tick * SamplePeriod;
+      durations[contactNumber] = fallingEdge - timestamps[contactNumber];
 
-      // handle timer overflow
-      if(now < timestamps[contactNumber])
-      {
-        timeSinceLastRisingEdge = UINT32_MAX - timestamps[contactNumber] + now;
-      }
+      Logger::info(nullptr, contactNumber, F(" open"));
 
-      if((inputStates & contactMask) > 0 && (timeSinceLastRisingEdge > debounceIn))
+      if(paired(contactNumber))
       {
-        durations[contactNumber] = timeSinceLastRisingEdge;
-
-        Serial.print(contactNumber); Serial.println(" open");
-
-        inputStates &= ~contactMask;
-
-        // Send message with timestamp and duration
-        send(contactNumber, timestamps[contactNumber], durations[contactNumber]);
+        passageEdge(contactNumber, false);
+        continue;
       }
+
+      // Send message with timestamp and duration
+      send(contactNumber, timestamps[contactNumber], durations[contactNumber]);
     }
   }
+
+  Logger::drain(); // only when no edges are waiting
 }